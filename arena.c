@@ -0,0 +1,63 @@
+/************************************************************************/
+/**
+ * \file   arena.c
+ * \brief  Fixed-size memory arena. Memory is taken from a single block
+ *         allocated up front, and released all at once.
+ * \author agent
+ ****************************************************************************/
+#include <stdlib.h>
+#include <limits.h>
+#include "arena.h"
+
+/**
+ * \brief Creates an arena, allocating all its memory.
+ *
+ * \param[out] a    Arena to create.
+ * \param[in]  size Arena size in bytes.
+ * \return TRUE on success, FALSE if memory couldn't be allocated.
+ ****************************************************************************/
+uint8_t ArenaCreate(Arena *a, uint32_t size)
+{
+  a->base = NULL;
+  a->size = a->used = 0;
+  /* malloc() can't take more than size_t, 16 bits on small models */
+  if (!size || size > UINT_MAX)
+    return FALSE;
+  if ((a->base = (uint8_t *)malloc((size_t)size)) == NULL)
+    return FALSE;
+  a->size = size;
+  return TRUE;
+}
+
+/**
+ * \brief Takes memory from the arena.
+ *
+ * \param[in] a    Arena to take memory from.
+ * \param[in] size Number of bytes needed.
+ * \return Pointer to the memory, or NULL if the arena has not enough room.
+ ****************************************************************************/
+void *ArenaAlloc(Arena *a, uint32_t size)
+{
+  uint8_t *p;
+
+  size = ARENA_ROUND(size);
+  if (a->base == NULL || size > a->size - a->used)
+    return NULL;
+  p = a->base + a->used;
+  a->used += size;
+  return p;
+}
+
+/**
+ * \brief Releases all the arena memory. Can be called on an arena that
+ * was never created or has already been released.
+ *
+ * \param[in] a Arena to release.
+ ****************************************************************************/
+void ArenaRelease(Arena *a)
+{
+  if (a->base != NULL)
+    free(a->base);
+  a->base = NULL;
+  a->size = a->used = 0;
+}
@@ -0,0 +1,56 @@
+/************************************************************************/
+/**
+ * \file   arena.h
+ * \brief  Fixed-size memory arena. Memory is taken from a single block
+ *         allocated up front, and released all at once.
+ * \author agent
+ ****************************************************************************/
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include "types.h"
+
+/* Allocations are rounded up to a multiple of this (power of 2) */
+#define ARENA_ALIGN 4
+
+/* Arena room taken by an allocation of n bytes */
+#define ARENA_ROUND(n) (((uint32_t)(n) + ARENA_ALIGN - 1) & ~(uint32_t)(ARENA_ALIGN - 1))
+
+typedef struct
+{
+  uint8_t *base; /* Arena memory, NULL if not created */
+  uint32_t size; /* Arena size */
+  uint32_t used; /* Bytes already handed out */
+} Arena;
+
+/************************************************************************/
+/**
+ * \brief Creates an arena, allocating all its memory.
+ *
+ * \param[out] a    Arena to create.
+ * \param[in]  size Arena size in bytes.
+ * \return TRUE on success, FALSE if memory couldn't be allocated.
+ ****************************************************************************/
+uint8_t ArenaCreate(Arena *a, uint32_t size);
+
+/************************************************************************/
+/**
+ * \brief Takes memory from the arena.
+ *
+ * \param[in] a    Arena to take memory from.
+ * \param[in] size Number of bytes needed.
+ * \return Pointer to the memory, or NULL if the arena has not enough room.
+ ****************************************************************************/
+void *ArenaAlloc(Arena *a, uint32_t size);
+
+/************************************************************************/
+/**
+ * \brief Releases all the arena memory. Can be called on an arena that
+ * was never created or has already been released.
+ *
+ * \param[in] a Arena to release.
+ ****************************************************************************/
+void ArenaRelease(Arena *a);
+
+#endif // _ARENA_H_
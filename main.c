@@ -2,13 +2,59 @@
 #include <stdlib.h>
 #include <string.h>
 #include "vgm.h"
+#include "ym2612.h"
+#include "merge.h"
+
+static const char *sourceName[MERGE_SOURCES] = {"FM", "DAC", "PSG"};
 
 int main(int argc, char **argv)
 {
   char *inputFile = NULL;
   int i;
+  uint8_t cards = 0;
+  uint32_t skipMs = 0;
+  const MergeStats *st;
   enum VGMErrorCode result;
-  for (i = 0; i < argc; i++){
+
+  VgmInit();
+
+  for (i = 1; i < argc; i++){
+    /* -p <hex>: base port of the next card, in chip order */
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc){
+      if (cards < YM2612_MAX_CHIPS){
+        Ym2612SetBase(cards++, (uint16_t)strtoul(argv[++i], NULL, 16));
+      } else {
+        fprintf(stderr, "Too many cards, %s ignored\r\n", argv[++i]);
+      }
+      continue;
+    }
+    /* -t <ns>: pace writes by time, each bus I/O taking at least ns.
+     * Playback is not timed yet and credits no waits, so this saves
+     * next to no status reads for now */
+    if (strcmp(argv[i], "-t") == 0 && i + 1 < argc){
+      Ym2612SetPacing(YM2612_PACE_BUDGET, (uint16_t)atoi(argv[++i]));
+      continue;
+    }
+    /* -r <n>: bus takes n writes every 16 samples */
+    if (strcmp(argv[i], "-r") == 0 && i + 1 < argc){
+      MergeSetRate((uint16_t)atoi(argv[++i]));
+      continue;
+    }
+    /* -c <Hz>: master clock of the cards, if not the NTSC one */
+    if (strcmp(argv[i], "-c") == 0 && i + 1 < argc){
+      Ym2612SetCardClock((uint32_t)strtoul(argv[++i], NULL, 10));
+      continue;
+    }
+    /* -m <bytes>: most memory the opened file may use */
+    if (strcmp(argv[i], "-m") == 0 && i + 1 < argc){
+      VgmSetMemCap((uint32_t)strtoul(argv[++i], NULL, 10));
+      continue;
+    }
+    /* -f <ms>: start playing this far into the track */
+    if (strcmp(argv[i], "-f") == 0 && i + 1 < argc){
+      skipMs = (uint32_t)strtoul(argv[++i], NULL, 10);
+      continue;
+    }
     if (strstr(argv[i], ".vgm") != NULL){
       inputFile = argv[i];
       break;
@@ -19,11 +65,30 @@ int main(int argc, char **argv)
     return 1;
 
   result = VgmOpen(inputFile);
-  if (result == VGM_OK){
-    fprintf(stderr, "Open complete\n");
-  } else {
+  if (result != VGM_OK){
+    fprintf(stderr, "Error: %d\r\n", result);
+    return 0;
+  }
+  fprintf(stderr, "Open complete\n");
+
+  if (skipMs && (result = VgmFf(skipMs)) != VGM_OK){
     fprintf(stderr, "Error: %d\r\n", result);
   }
+  if (result == VGM_OK && (result = VgmPlay()) != VGM_OK){
+    fprintf(stderr, "Error: %d\r\n", result);
+  }
+  fprintf(stderr, "Cursor: %lu samples\r\n", (unsigned long)VgmGetCursor());
+  /* How far from their sample writes went out */
+  for (i = 0; i < MERGE_SOURCES; i++){
+    st = MergeGetStats((MergeSource)i);
+    if (!st->events)
+      continue;
+    fprintf(stderr, "%s: %lu writes, %lu late, error total %lu max %lu, %lu forced\r\n",
+            sourceName[i], (unsigned long)st->events, (unsigned long)st->late,
+            (unsigned long)st->totalErr, (unsigned long)st->maxErr,
+            (unsigned long)st->forced);
+  }
+  VgmClose();
 
   return 0;
 }
@@ -0,0 +1,275 @@
+/************************************************************************/
+/**
+ * \file   merge.c
+ * \brief  Merges the writes of several sources (FM, DAC, PSG) due at given
+ *         samples into a single stream, limited to the bus write rate.
+ * \author agent
+ ****************************************************************************/
+#include <string.h>
+#include "merge.h"
+
+/* YM2612 key on/off, DAC data and DAC enable registers */
+#define MERGE_KEY_REG 0x28
+#define MERGE_DAC_REG 0x2A
+#define MERGE_DAC_EN_REG 0x2B
+
+/* Channel mask bits: 8 per chip, channel codes as in the key register.
+ * Code 3 is not a channel, and stands for the DAC */
+#define MERGE_CH_CHIPS 4
+#define MERGE_CH_DAC 3
+#define MERGE_CH_ALL 0xFFFFFFFFUL
+
+typedef struct
+{
+  MergeEvent *q;      /* Pending writes, oldest first */
+  uint16_t count;     /* Number of pending writes */
+  uint32_t now;       /* Current sample */
+  uint16_t rate;      /* Writes per MERGE_RATE_DIV samples */
+  uint16_t credit;    /* Bus slots earned, in 1/MERGE_RATE_DIV units */
+  MergeSink sink[MERGE_SOURCES];
+  MergeReport report;
+  MergeStats stats[MERGE_SOURCES];
+} MergeData;
+
+/* Merger module data */
+static MergeData md;
+
+/* Returns TRUE for DAC writes: 0x8n data, or FM writes to the DAC
+ * data and enable registers */
+static uint8_t MergeIsDac(const MergeEvent *e)
+{
+  if (MERGE_DAC == e->source)
+    return TRUE;
+  return MERGE_FM == e->source && !e->port &&
+    (MERGE_DAC_REG == e->reg || MERGE_DAC_EN_REG == e->reg);
+}
+
+/* Returns TRUE for writes that go ahead of the rest */
+static uint8_t MergeIsPriority(const MergeEvent *e)
+{
+  if (MergeIsDac(e))
+    return TRUE;
+  return MERGE_FM == e->source && !e->port && MERGE_KEY_REG == e->reg;
+}
+
+/* Returns the mask of the channels (or DAC) a YM2612 write affects */
+static uint32_t MergeChannels(const MergeEvent *e)
+{
+  uint8_t ch;
+
+  if (MERGE_PSG == e->source)
+    return 0;
+  if (e->chip >= MERGE_CH_CHIPS)
+    return MERGE_CH_ALL;
+  if (MergeIsDac(e))
+    ch = MERGE_CH_DAC;
+  else if (MERGE_KEY_REG == e->reg && !e->port){
+    ch = e->val & 7;
+    /* Codes 3 and 7 key nothing */
+    if (3 == (ch & 3))
+      return 0;
+  }
+  else if (!e->port && e->reg >= 0xA8 && e->reg < 0xB0)
+    /* Channel 3 special mode operator frequencies */
+    ch = 2;
+  else if (e->reg >= 0x30 && (e->reg & 3) != 3)
+    ch = (e->reg & 3) + (e->port ? 4 : 0);
+  else
+    /* Global registers affect every channel of the chip, but not the DAC */
+    return (0xFFUL & ~(1UL << MERGE_CH_DAC)) << (e->chip * 8);
+  return 1UL << (e->chip * 8 + ch);
+}
+
+/**
+ * \brief Picks the next write to send: the oldest priority write due that
+ * doesn't overtake a write to its channel (or, for DAC writes, another DAC
+ * write), or else the oldest write due.
+ *
+ * \return Index of the write, or md.count if none is due.
+ ****************************************************************************/
+static uint16_t MergePick(void)
+{
+  uint16_t i;
+  uint16_t oldest = md.count;
+  uint32_t held = 0;
+  uint32_t ch;
+  MergeEvent *e;
+
+  for (i = 0; i < md.count; i++){
+    e = &md.q[i];
+    if (e->sample > md.now)
+      continue;
+    if (oldest == md.count)
+      oldest = i;
+    ch = MergeChannels(e);
+    if (MergeIsPriority(e) && !(ch & held))
+      return i;
+    held |= ch;
+  }
+  return oldest;
+}
+
+/* Sends a pending write and accounts its delay */
+static void MergeSend(uint16_t i)
+{
+  MergeEvent e = md.q[i];
+  MergeStats *st = &md.stats[e.source];
+  uint32_t err = (md.now > e.sample) ? md.now - e.sample : 0;
+
+  md.count--;
+  memmove(&md.q[i], &md.q[i + 1], (md.count - i) * sizeof(MergeEvent));
+  if (md.sink[e.source] != NULL)
+    md.sink[e.source](&e);
+
+  st->events++;
+  st->totalErr += err;
+  if (err){
+    st->late++;
+    if (err > st->maxErr)
+      st->maxErr = err;
+  }
+  if (md.report != NULL)
+    md.report(&e, err);
+}
+
+/**
+ * \brief Sets up the merger. Pending writes are dropped, and statistics
+ * are cleared.
+ *
+ * \param[in] buf Room for MERGE_QUEUE_LEN events.
+ ****************************************************************************/
+void MergeInit(MergeEvent *buf)
+{
+  md.q = buf;
+  md.count = 0;
+  md.now = 0;
+  md.credit = 0;
+  memset(md.stats, 0, sizeof(md.stats));
+  if (!md.rate)
+    md.rate = MERGE_RATE_DEFAULT;
+}
+
+/**
+ * \brief Sets the bus write rate.
+ *
+ * \param[in] rate Writes per MERGE_RATE_DIV samples, at least 1.
+ ****************************************************************************/
+void MergeSetRate(uint16_t rate)
+{
+  md.rate = rate ? rate : 1;
+}
+
+/**
+ * \brief Sets where the writes of a source are sent.
+ *
+ * \param[in] source Source to set.
+ * \param[in] sink   Function sending the write, NULL to drop them.
+ ****************************************************************************/
+void MergeSetSink(MergeSource source, MergeSink sink)
+{
+  if (source < MERGE_SOURCES)
+    md.sink[source] = sink;
+}
+
+/**
+ * \brief Sets a function to be called with each write sent and its delay.
+ *
+ * \param[in] report Function to call, NULL for none.
+ ****************************************************************************/
+void MergeSetReport(MergeReport report)
+{
+  md.report = report;
+}
+
+/**
+ * \brief Drops pending writes, and moves the merger to the given sample.
+ *
+ * \param[in] sample Current sample.
+ ****************************************************************************/
+void MergeReset(uint32_t sample)
+{
+  md.count = 0;
+  md.now = sample;
+  md.credit = 0;
+}
+
+/**
+ * \brief Adds a write. If the queue is full, the oldest writes are sent
+ * right away, outside the bus slots.
+ *
+ * \param[in] source Write source.
+ * \param[in] chip   Chip number.
+ * \param[in] port   Chip port.
+ * \param[in] reg    Register.
+ * \param[in] val    Value.
+ * \param[in] sample Sample the write is due at.
+ ****************************************************************************/
+void MergePush(MergeSource source, uint8_t chip, uint8_t port, uint8_t reg,
+               uint8_t val, uint32_t sample)
+{
+  MergeEvent *e;
+
+  if (md.q == NULL)
+    return;
+  while (md.count >= MERGE_QUEUE_LEN){
+    md.stats[md.q[0].source].forced++;
+    MergeSend(0);
+  }
+  e = &md.q[md.count++];
+  e->sample = sample;
+  e->source = (uint8_t)source;
+  e->chip = chip;
+  e->port = port;
+  e->reg = reg;
+  e->val = val;
+}
+
+/**
+ * \brief Sends pending writes in the bus slots of each sample, up to (not
+ * including) the given one.
+ *
+ * \param[in] sample Sample to advance to.
+ ****************************************************************************/
+void MergeAdvance(uint32_t sample)
+{
+  uint16_t i;
+
+  while (md.now < sample){
+    /* Nothing to send, unused slots are lost */
+    if (!md.count){
+      md.now = sample;
+      md.credit %= MERGE_RATE_DIV;
+      return;
+    }
+    md.credit += md.rate;
+    while (md.credit >= MERGE_RATE_DIV){
+      if ((i = MergePick()) == md.count){
+        md.credit %= MERGE_RATE_DIV;
+        break;
+      }
+      MergeSend(i);
+      md.credit -= MERGE_RATE_DIV;
+    }
+    md.now++;
+  }
+}
+
+/**
+ * \brief Keeps advancing until all pending writes have been sent.
+ ****************************************************************************/
+void MergeDrain(void)
+{
+  while (md.count)
+    MergeAdvance(md.now + 1);
+}
+
+/**
+ * \brief Returns the statistics of a source.
+ *
+ * \param[in] source Source to get statistics from.
+ * \return The source statistics.
+ ****************************************************************************/
+const MergeStats *MergeGetStats(MergeSource source)
+{
+  return &md.stats[source < MERGE_SOURCES ? source : MERGE_FM];
+}
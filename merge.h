@@ -0,0 +1,144 @@
+/************************************************************************/
+/**
+ * \file   merge.h
+ * \brief  Merges the writes of several sources (FM, DAC, PSG) due at given
+ *         samples into a single stream, limited to the bus write rate.
+ *
+ * Each sample gets a number of bus slots. Pending writes due at or before
+ * the current sample fill them, key on/off and DAC writes (0x8n data, and
+ * registers 0x2A/0x2B) first, then the rest in arrival order. A key on/off
+ * never overtakes an earlier write to the same channel, and DAC writes keep
+ * their order. The delay of each write (in samples) is reported.
+ *
+ * \author agent
+ ****************************************************************************/
+
+#ifndef _MERGE_H_
+#define _MERGE_H_
+
+#include "types.h"
+
+/* Number of pending writes the merger can hold */
+#define MERGE_QUEUE_LEN   256
+
+/* Bus rate is given in writes per MERGE_RATE_DIV samples */
+#define MERGE_RATE_DIV    16
+
+/* Default bus rate, one write per sample */
+#define MERGE_RATE_DEFAULT MERGE_RATE_DIV
+
+typedef enum
+  {
+    MERGE_FM,       /* < YM2612 register writes */
+    MERGE_DAC,      /* < YM2612 DAC data writes */
+    MERGE_PSG,      /* < SN76489 writes */
+    MERGE_SOURCES
+  } MergeSource;
+
+typedef struct
+{
+  uint32_t sample; /* Sample the write is due at */
+  uint8_t source;  /* MergeSource */
+  uint8_t chip;    /* Chip number */
+  uint8_t port;    /* Chip port */
+  uint8_t reg;     /* Register (unused for PSG) */
+  uint8_t val;     /* Value */
+} MergeEvent;
+
+typedef struct
+{
+  uint32_t events;   /* Writes sent */
+  uint32_t late;     /* Writes sent after the sample they were due at */
+  uint32_t totalErr; /* Sum of the delays, in samples */
+  uint32_t maxErr;   /* Largest delay, in samples */
+  uint32_t forced;   /* Writes sent outside a bus slot, queue being full */
+} MergeStats;
+
+/* Sends a write to its chip */
+typedef void (*MergeSink)(const MergeEvent *e);
+
+/* Gets every write sent, with its delay in samples */
+typedef void (*MergeReport)(const MergeEvent *e, uint32_t err);
+
+/************************************************************************/
+/**
+ * \brief Sets up the merger. Pending writes are dropped, and statistics
+ * are cleared.
+ *
+ * \param[in] buf Room for MERGE_QUEUE_LEN events.
+ ****************************************************************************/
+void MergeInit(MergeEvent *buf);
+
+/************************************************************************/
+/**
+ * \brief Sets the bus write rate.
+ *
+ * \param[in] rate Writes per MERGE_RATE_DIV samples, at least 1.
+ ****************************************************************************/
+void MergeSetRate(uint16_t rate);
+
+/************************************************************************/
+/**
+ * \brief Sets where the writes of a source are sent.
+ *
+ * \param[in] source Source to set.
+ * \param[in] sink   Function sending the write, NULL to drop them.
+ ****************************************************************************/
+void MergeSetSink(MergeSource source, MergeSink sink);
+
+/************************************************************************/
+/**
+ * \brief Sets a function to be called with each write sent and its delay.
+ *
+ * \param[in] report Function to call, NULL for none.
+ ****************************************************************************/
+void MergeSetReport(MergeReport report);
+
+/************************************************************************/
+/**
+ * \brief Drops pending writes, and moves the merger to the given sample.
+ *
+ * \param[in] sample Current sample.
+ ****************************************************************************/
+void MergeReset(uint32_t sample);
+
+/************************************************************************/
+/**
+ * \brief Adds a write. If the queue is full, the oldest writes are sent
+ * right away, outside the bus slots.
+ *
+ * \param[in] source Write source.
+ * \param[in] chip   Chip number.
+ * \param[in] port   Chip port.
+ * \param[in] reg    Register.
+ * \param[in] val    Value.
+ * \param[in] sample Sample the write is due at.
+ ****************************************************************************/
+void MergePush(MergeSource source, uint8_t chip, uint8_t port, uint8_t reg,
+               uint8_t val, uint32_t sample);
+
+/************************************************************************/
+/**
+ * \brief Sends pending writes in the bus slots of each sample, up to (not
+ * including) the given one.
+ *
+ * \param[in] sample Sample to advance to.
+ ****************************************************************************/
+void MergeAdvance(uint32_t sample);
+
+/************************************************************************/
+/**
+ * \brief Keeps advancing until all pending writes have been sent.
+ ****************************************************************************/
+void MergeDrain(void);
+
+/************************************************************************/
+/**
+ * \brief Returns the statistics of a source.
+ *
+ * \param[in] source Source to get statistics from.
+ * \return The source statistics.
+ ****************************************************************************/
+const MergeStats *MergeGetStats(MergeSource source);
+
+#endif // _MERGE_H_
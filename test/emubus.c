@@ -0,0 +1,174 @@
+/************************************************************************/
+/**
+ * \file   emubus.c
+ * \brief  Emulated ISA bus with YM2612 cards, used as the port I/O
+ *         backend of the ym2612 module to test write pacing.
+ * \author agent
+ ****************************************************************************/
+#include "emubus.h"
+
+typedef struct
+{
+  uint16_t base;      /* Card base port, 0 if the slot is free */
+  uint32_t lastWrite; /* Time of the end of the last data write */
+  uint8_t written;    /* A data write has been seen */
+  uint8_t addr;       /* Register selected by the last address write */
+} EmuCard;
+
+typedef struct
+{
+  uint32_t now;       /* Emulated time, in ns */
+  uint16_t ioNs;
+  uint16_t jitterNs;
+  uint32_t busyNs;
+  uint32_t seed;      /* Jitter pseudo-random generator state */
+  EmuCard cards[YM2612_MAX_CHIPS];
+  EmuBusStats stats;
+  EmuBusWrite log[EMUBUS_LOG_LEN];
+  uint16_t logLen;
+} EmuBusData;
+
+/* Emulated bus data */
+static EmuBusData eb;
+
+/* Advances time by the length of one I/O operation */
+static void EmuBusCycle(void)
+{
+  eb.seed = eb.seed * 1103515245UL + 12345;
+  eb.now += eb.ioNs;
+  if (eb.jitterNs)
+    eb.now += (uint16_t)(eb.seed >> 16) % (eb.jitterNs + 1);
+}
+
+/* Returns the card decoding the port, taking a free slot if needed */
+static EmuCard *EmuBusCard(uint16_t port)
+{
+  uint8_t i;
+  uint16_t base = port & ~3;
+
+  for (i = 0; i < YM2612_MAX_CHIPS; i++){
+    if (eb.cards[i].base == base)
+      return &eb.cards[i];
+  }
+  for (i = 0; i < YM2612_MAX_CHIPS; i++){
+    if (!eb.cards[i].base){
+      eb.cards[i].base = base;
+      return &eb.cards[i];
+    }
+  }
+  return NULL;
+}
+
+/* Checks if the card is still busy from its last data write */
+static uint8_t EmuBusBusy(const EmuCard *c)
+{
+  return c->written && (uint32_t)(eb.now - c->lastWrite) < eb.busyNs;
+}
+
+static uint8_t EmuBusIn(uint16_t port)
+{
+  EmuCard *c = EmuBusCard(port);
+  uint8_t status;
+
+  eb.stats.reads++;
+  /* Status is sampled at the start of the read */
+  status = (c != NULL && EmuBusBusy(c)) ? 0x80 : 0x00;
+  EmuBusCycle();
+  return status;
+}
+
+static void EmuBusOut(uint16_t port, uint8_t val)
+{
+  EmuCard *c = EmuBusCard(port);
+  EmuBusWrite *w;
+
+  if (c != NULL && EmuBusBusy(c))
+    eb.stats.violations++;
+  EmuBusCycle();
+  if (c == NULL)
+    return;
+  /* Even ports select a register */
+  if (!(port & 1)){
+    c->addr = val;
+    return;
+  }
+  /* Odd ports take data, busy time starts once the write is over */
+  eb.stats.writes++;
+  c->lastWrite = eb.now;
+  c->written = TRUE;
+  if (eb.logLen < EMUBUS_LOG_LEN){
+    w = &eb.log[eb.logLen++];
+    w->base = c->base;
+    w->port = (port & 2) != 0;
+    w->reg = c->addr;
+    w->val = val;
+  }
+}
+
+static const Ym2612Io emuBusIo = {EmuBusIn, EmuBusOut};
+
+/**
+ * \brief Resets the emulated bus, with all the cards idle.
+ *
+ * \param[in] ioNs     Minimum time taken by one I/O operation, in ns.
+ * \param[in] jitterNs Maximum extra time added to an I/O operation, in ns.
+ * \param[in] busyNs   Time a card stays busy after a data write, in ns.
+ ****************************************************************************/
+void EmuBusInit(uint16_t ioNs, uint16_t jitterNs, uint32_t busyNs)
+{
+  uint8_t i;
+
+  eb.now = 0;
+  eb.ioNs = ioNs;
+  eb.jitterNs = jitterNs;
+  eb.busyNs = busyNs;
+  eb.seed = 1;
+  for (i = 0; i < YM2612_MAX_CHIPS; i++){
+    eb.cards[i].base = 0;
+    eb.cards[i].written = FALSE;
+  }
+  eb.stats.reads = eb.stats.writes = eb.stats.violations = 0;
+  eb.logLen = 0;
+}
+
+/**
+ * \brief Returns the port I/O backend reaching the emulated bus.
+ *
+ * \return The backend, to pass to Ym2612SetIo().
+ ****************************************************************************/
+const Ym2612Io *EmuBusIo(void)
+{
+  return &emuBusIo;
+}
+
+/**
+ * \brief Lets time pass without bus activity, e.g. a timed VGM wait.
+ *
+ * \param[in] ns Time to pass, in ns.
+ ****************************************************************************/
+void EmuBusWait(uint32_t ns)
+{
+  eb.now += ns;
+}
+
+/**
+ * \brief Returns the bus statistics since the last EmuBusInit().
+ *
+ * \return The bus statistics.
+ ****************************************************************************/
+const EmuBusStats *EmuBusGetStats(void)
+{
+  return &eb.stats;
+}
+
+/**
+ * \brief Returns the register writes logged since the last EmuBusInit().
+ *
+ * \param[out] len Number of writes logged.
+ * \return The logged writes, oldest first.
+ ****************************************************************************/
+const EmuBusWrite *EmuBusGetLog(uint16_t *len)
+{
+  *len = eb.logLen;
+  return eb.log;
+}
@@ -0,0 +1,82 @@
+/************************************************************************/
+/**
+ * \file   emubus.h
+ * \brief  Emulated ISA bus with YM2612 cards, used as the port I/O
+ *         backend of the ym2612 module to test write pacing.
+ *
+ * Every I/O operation takes ioNs plus some pseudo-random extra time,
+ * as the real bus is never faster than the bound given to the pacing.
+ * Each card reports busy for busyNs after a data write. Status reads
+ * are counted, and so are writes sent while the card was busy. The first
+ * EMUBUS_LOG_LEN register writes are logged, to check their order.
+ *
+ * \author agent
+ ****************************************************************************/
+
+#ifndef _EMUBUS_H_
+#define _EMUBUS_H_
+
+#include "../ym2612.h"
+
+/* Register writes the log can hold */
+#define EMUBUS_LOG_LEN 1024
+
+typedef struct
+{
+  uint16_t base; /* Card base port */
+  uint8_t port;  /* Chip port */
+  uint8_t reg;   /* Register */
+  uint8_t val;   /* Value */
+} EmuBusWrite;
+
+typedef struct
+{
+  uint32_t reads;      /* Status port reads */
+  uint32_t writes;     /* Register data writes */
+  uint32_t violations; /* Writes sent before the busy time was over */
+} EmuBusStats;
+
+/************************************************************************/
+/**
+ * \brief Resets the emulated bus, with all the cards idle.
+ *
+ * \param[in] ioNs     Minimum time taken by one I/O operation, in ns.
+ * \param[in] jitterNs Maximum extra time added to an I/O operation, in ns.
+ * \param[in] busyNs   Time a card stays busy after a data write, in ns.
+ ****************************************************************************/
+void EmuBusInit(uint16_t ioNs, uint16_t jitterNs, uint32_t busyNs);
+
+/************************************************************************/
+/**
+ * \brief Returns the port I/O backend reaching the emulated bus.
+ *
+ * \return The backend, to pass to Ym2612SetIo().
+ ****************************************************************************/
+const Ym2612Io *EmuBusIo(void);
+
+/************************************************************************/
+/**
+ * \brief Lets time pass without bus activity, e.g. a timed VGM wait.
+ *
+ * \param[in] ns Time to pass, in ns.
+ ****************************************************************************/
+void EmuBusWait(uint32_t ns);
+
+/************************************************************************/
+/**
+ * \brief Returns the bus statistics since the last EmuBusInit().
+ *
+ * \return The bus statistics.
+ ****************************************************************************/
+const EmuBusStats *EmuBusGetStats(void);
+
+/************************************************************************/
+/**
+ * \brief Returns the register writes logged since the last EmuBusInit().
+ *
+ * \param[out] len Number of writes logged.
+ * \return The logged writes, oldest first.
+ ****************************************************************************/
+const EmuBusWrite *EmuBusGetLog(uint16_t *len);
+
+#endif // _EMUBUS_H_
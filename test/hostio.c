@@ -0,0 +1,21 @@
+/************************************************************************/
+/**
+ * \file   hostio.c
+ * \brief  Stands in for <dos.h> when building the ym2612 module on the
+ *         host for tests.
+ * \author agent
+ ****************************************************************************/
+#include "hostio.h"
+
+/* Reads as busy, so a test missing its emulated backend hangs instead of
+ * passing */
+unsigned char peekb(unsigned seg, unsigned off)
+{
+  (void)seg; (void)off;
+  return 0x80;
+}
+
+void pokeb(unsigned seg, unsigned val, unsigned off)
+{
+  (void)seg; (void)val; (void)off;
+}
@@ -0,0 +1,17 @@
+/************************************************************************/
+/**
+ * \file   hostio.h
+ * \brief  Stands in for <dos.h> when building the ym2612 module on the
+ *         host for tests. Real port access is not available there, so
+ *         tests must set an emulated backend with Ym2612SetIo().
+ * \author agent
+ ****************************************************************************/
+
+#ifndef _HOSTIO_H_
+#define _HOSTIO_H_
+
+unsigned char peekb(unsigned seg, unsigned off);
+
+void pokeb(unsigned seg, unsigned val, unsigned off);
+
+#endif // _HOSTIO_H_
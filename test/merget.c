@@ -0,0 +1,185 @@
+/************************************************************************/
+/**
+ * \file   merget.c
+ * \brief  Checks the write merger: send order of key on/off, DAC and
+ *         global writes, bus slot spreading and delay statistics.
+ * \author agent
+ ****************************************************************************/
+#include <stdio.h>
+#include "../merge.h"
+
+/* Most writes a check pushes */
+#define TEST_MAX_WRITES 16
+
+typedef struct
+{
+  uint8_t source;
+  uint8_t chip;
+  uint8_t port;
+  uint8_t reg;
+  uint8_t val;
+} TestWrite;
+
+/* Merger queue */
+static MergeEvent buf[MERGE_QUEUE_LEN];
+
+/* Writes pushed by the running check, and the order they were sent in */
+static const TestWrite *pushed;
+static uint8_t pushedLen;
+static uint8_t order[TEST_MAX_WRITES];
+static uint32_t sentAt[TEST_MAX_WRITES];
+static uint8_t sent;
+
+/* Records each write sent: its index in the pushed ones, and its sample */
+static void TestReport(const MergeEvent *e, uint32_t err)
+{
+  uint8_t i;
+
+  if (sent >= TEST_MAX_WRITES)
+    return;
+  for (i = 0; i < pushedLen; i++){
+    if (pushed[i].source == e->source && pushed[i].chip == e->chip &&
+        pushed[i].port == e->port && pushed[i].reg == e->reg &&
+        pushed[i].val == e->val)
+      break;
+  }
+  order[sent] = i;
+  sentAt[sent++] = e->sample + err;
+}
+
+/* Pushes writes all due at sample 0, and sends them at the given rate */
+static void TestRun(const TestWrite *w, uint8_t len, uint16_t rate)
+{
+  uint8_t i;
+
+  MergeInit(buf);
+  MergeSetRate(rate);
+  MergeSetReport(TestReport);
+  pushed = w;
+  pushedLen = len;
+  sent = 0;
+  for (i = 0; i < len; i++)
+    MergePush((MergeSource)w[i].source, w[i].chip, w[i].port, w[i].reg,
+              w[i].val, 0);
+  MergeDrain();
+}
+
+/**
+ * \brief Sends writes one per sample, and checks the order they went out.
+ *
+ * \param[in] name   Check name.
+ * \param[in] w      Writes to push, in stream order.
+ * \param[in] len    Number of writes.
+ * \param[in] expect Expected send order, as indices into w.
+ * \return TRUE if the writes were sent in the expected order.
+ ****************************************************************************/
+static uint8_t TestOrder(const char *name, const TestWrite *w, uint8_t len,
+                         const uint8_t *expect)
+{
+  uint8_t i;
+  uint8_t ok;
+
+  TestRun(w, len, MERGE_RATE_DIV);
+  ok = sent == len;
+  printf("%-8s order", name);
+  for (i = 0; i < sent; i++){
+    printf(" %u", order[i]);
+    if (order[i] != expect[i])
+      ok = FALSE;
+  }
+  printf("\n");
+  if (!ok)
+    printf("FAIL: %s\n", name);
+  return ok;
+}
+
+/**
+ * \brief Sends a burst at a bus rate, and checks the sample each write went
+ * out at and the delay statistics.
+ *
+ * \param[in] rate     Bus rate, in writes per MERGE_RATE_DIV samples.
+ * \param[in] at       Expected send sample of each write.
+ * \param[in] late     Expected late writes.
+ * \param[in] totalErr Expected sum of the delays.
+ * \param[in] maxErr   Expected largest delay.
+ * \return TRUE if the burst was spread and accounted as expected.
+ ****************************************************************************/
+static uint8_t TestRate(uint16_t rate, const uint32_t *at, uint32_t late,
+                        uint32_t totalErr, uint32_t maxErr)
+{
+  static const TestWrite burst[8] = {
+    {MERGE_FM, 0, 0, 0x30, 0}, {MERGE_FM, 0, 0, 0x31, 1},
+    {MERGE_FM, 0, 0, 0x32, 2}, {MERGE_FM, 0, 1, 0x30, 3},
+    {MERGE_FM, 0, 1, 0x31, 4}, {MERGE_FM, 0, 1, 0x32, 5},
+    {MERGE_FM, 0, 0, 0x40, 6}, {MERGE_FM, 0, 0, 0x41, 7}
+  };
+  const MergeStats *st;
+  uint8_t i;
+  uint8_t ok;
+
+  TestRun(burst, 8, rate);
+  st = MergeGetStats(MERGE_FM);
+  ok = sent == 8 && st->events == 8 && st->late == late &&
+    st->totalErr == totalErr && st->maxErr == maxErr && !st->forced;
+  printf("rate %-3u sent at", rate);
+  for (i = 0; i < sent; i++){
+    printf(" %lu", (unsigned long)sentAt[i]);
+    if (order[i] != i || sentAt[i] != at[i])
+      ok = FALSE;
+  }
+  printf("  late %lu  error total %lu max %lu\n", (unsigned long)st->late,
+         (unsigned long)st->totalErr, (unsigned long)st->maxErr);
+  if (!ok)
+    printf("FAIL: rate %u\n", rate);
+  return ok;
+}
+
+int main(void)
+{
+  /* A key on waits for the earlier writes to its channel, and goes ahead
+   * of the writes to other channels */
+  static const TestWrite key[5] = {
+    {MERGE_FM, 0, 0, 0x30, 1}, {MERGE_FM, 0, 0, 0xA4, 2},
+    {MERGE_FM, 0, 0, 0xA0, 3}, {MERGE_FM, 0, 0, 0x28, 0xF0},
+    {MERGE_FM, 0, 0, 0x28, 0xF4}
+  };
+  static const uint8_t keyOrder[5] = {4, 0, 1, 2, 3};
+  /* Channel 3 special mode frequencies (0xA8-0xAE) belong to channel 3
+   * (code 2), whatever the low register bits */
+  static const TestWrite ch3[7] = {
+    {MERGE_FM, 0, 0, 0x31, 1}, {MERGE_FM, 0, 0, 0xAC, 2},
+    {MERGE_FM, 0, 0, 0xA8, 3}, {MERGE_FM, 0, 0, 0xAD, 4},
+    {MERGE_FM, 0, 0, 0x28, 0xF2}, {MERGE_FM, 0, 0, 0x28, 0xF1},
+    {MERGE_FM, 0, 0, 0x28, 0xF0}
+  };
+  static const uint8_t ch3Order[7] = {6, 0, 5, 1, 2, 3, 4};
+  /* 0x8n data and 0x2A/0x2B register writes share the DAC order */
+  static const TestWrite dac[5] = {
+    {MERGE_FM, 0, 0, 0x30, 1}, {MERGE_DAC, 0, 0, 0x2A, 2},
+    {MERGE_FM, 0, 0, 0x2B, 0x80}, {MERGE_FM, 0, 0, 0x2A, 3},
+    {MERGE_DAC, 0, 0, 0x2A, 4}
+  };
+  static const uint8_t dacOrder[5] = {1, 2, 3, 4, 0};
+  /* A global write holds back the channels of its own chip only, and not
+   * the DAC */
+  static const TestWrite global[4] = {
+    {MERGE_FM, 0, 0, 0x22, 1}, {MERGE_FM, 0, 0, 0x28, 0xF0},
+    {MERGE_FM, 1, 0, 0x28, 0xF0}, {MERGE_DAC, 0, 0, 0x2A, 2}
+  };
+  static const uint8_t globalOrder[4] = {2, 3, 0, 1};
+  /* One write every 4 samples, and 3 writes every 2 samples */
+  static const uint32_t slow[8] = {3, 7, 11, 15, 19, 23, 27, 31};
+  static const uint32_t fast[8] = {0, 1, 1, 2, 3, 3, 4, 5};
+  uint8_t ok = TRUE;
+
+  ok &= TestOrder("key", key, 5, keyOrder);
+  ok &= TestOrder("ch3", ch3, 7, ch3Order);
+  ok &= TestOrder("dac", dac, 5, dacOrder);
+  ok &= TestOrder("global", global, 4, globalOrder);
+  ok &= TestRate(4, slow, 8, 136, 31);
+  ok &= TestRate(24, fast, 7, 19, 5);
+  if (!ok)
+    return 1;
+  printf("OK\n");
+  return 0;
+}
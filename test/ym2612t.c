@@ -0,0 +1,271 @@
+/************************************************************************/
+/**
+ * \file   ym2612t.c
+ * \brief  Checks YM2612 write pacing against an emulated bus: writes must
+ *         never break the busy window, and budget pacing with timed waits
+ *         must read the status port less often than polling. Also checks
+ *         the order of the writes rebuilding the chip state after a skip.
+ * \author agent
+ ****************************************************************************/
+#include <stdio.h>
+#include "../ym2612.h"
+#include "emubus.h"
+
+/* NTSC Megadrive YM2612 clock, the cards run at it */
+#define TEST_CLK     7670453UL
+/* Clock of a rip made for a faster chip */
+#define TEST_FAST_CLK 8000000UL
+/* Timed gap between writes, longer than the busy time at TEST_FAST_CLK
+ * (24000 ns) but shorter than the real one */
+#define TEST_GAP_NS  24500UL
+#define TEST_GAPS    100
+/* Busy time of a real chip at TEST_CLK: 192 clocks, rounded up */
+#define TEST_BUSY_NS 25032UL
+/* Pacing bound, and the most a bus I/O takes on top of it */
+#define TEST_IO_NS   1000
+#define TEST_JITTER  400
+/* One sample at 44100 Hz */
+#define TEST_SAMPLE_NS 22676UL
+/* Data writes made by TestPlay() */
+#define TEST_WRITES  (60UL * (60 + 200))
+
+/* Lets a VGM wait pass. Timed playback tells the pacing about it */
+static void TestWait(uint32_t samples, uint8_t timed)
+{
+  Ym2612Flush();
+  EmuBusWait(samples * TEST_SAMPLE_NS);
+  if (timed)
+    Ym2612Elapse(samples * TEST_SAMPLE_NS);
+}
+
+/**
+ * \brief Plays a dual-chip stream: a burst of FM writes to both chips once
+ * per frame, and DAC writes to chip 0 every 3 samples (14.7 kHz) in
+ * between.
+ *
+ * \param[in] pace  Pacing mode.
+ * \param[in] timed TRUE to credit waits with Ym2612Elapse().
+ * \param[in] clk   Clock the stream was made for.
+ * \return Bus statistics.
+ ****************************************************************************/
+static const EmuBusStats *TestPlay(Ym2612Pace pace, uint8_t timed,
+                                   uint32_t clk)
+{
+  uint16_t frame;
+  uint16_t i;
+
+  Ym2612Init();
+  Ym2612SetBase(0, 0x2b0);
+  Ym2612SetBase(1, 0x2c0);
+  EmuBusInit(TEST_IO_NS, TEST_JITTER, TEST_BUSY_NS);
+  Ym2612SetIo(EmuBusIo());
+  Ym2612SetClock(clk);
+  Ym2612SetPacing(pace, TEST_IO_NS);
+
+  for (frame = 0; frame < 60; frame++){
+    for (i = 0; i < 30; i++){
+      Ym2612QueueWrite(0, i & 1, (uint8_t)(0x30 + i), (uint8_t)frame);
+      Ym2612QueueWrite(1, i & 1, (uint8_t)(0x30 + i), (uint8_t)frame);
+    }
+    TestWait(1, timed);
+    for (i = 0; i < 200; i++){
+      Ym2612QueueWrite(0, 0, 0x2A, (uint8_t)i);
+      TestWait(3, timed);
+    }
+    TestWait(134, timed);
+  }
+  Ym2612Flush();
+  return EmuBusGetStats();
+}
+
+/**
+ * \brief Writes to a single chip with a timed gap after each write, long
+ * enough for a chip at the stream clock but too short for the card.
+ *
+ * \param[in] clk Clock the stream was made for.
+ * \return Bus statistics.
+ ****************************************************************************/
+static const EmuBusStats *TestGaps(uint32_t clk)
+{
+  uint16_t i;
+
+  Ym2612Init();
+  Ym2612SetBase(0, 0x2b0);
+  EmuBusInit(TEST_IO_NS, TEST_JITTER, TEST_BUSY_NS);
+  Ym2612SetIo(EmuBusIo());
+  Ym2612SetClock(clk);
+  Ym2612SetPacing(YM2612_PACE_BUDGET, TEST_IO_NS);
+
+  for (i = 0; i < TEST_GAPS; i++){
+    Ym2612QueueWrite(0, 0, 0x30, (uint8_t)i);
+    Ym2612Flush();
+    EmuBusWait(TEST_GAP_NS);
+    Ym2612Elapse(TEST_GAP_NS);
+  }
+  Ym2612Flush();
+  return EmuBusGetStats();
+}
+
+/**
+ * \brief Checks the writes of a restore: key offs of every channel, then
+ * registers with each frequency MSB right before its LSB, then key ons.
+ *
+ * \param[in]  w      Logged writes of the restore.
+ * \param[in]  n      Number of writes.
+ * \param[out] pairs  Frequency MSB/LSB pairs written.
+ * \param[out] keyOns Key ons written.
+ * \return TRUE if the order is right.
+ ****************************************************************************/
+static uint8_t TestRestoreOrder(const EmuBusWrite *w, uint16_t n,
+                                uint16_t *pairs, uint16_t *keyOns)
+{
+  static const uint8_t offs[6] = {0, 1, 2, 4, 5, 6};
+  uint16_t i;
+
+  *pairs = *keyOns = 0;
+  if (n < 6)
+    return FALSE;
+  for (i = 0; i < 6; i++){
+    if (w[i].port || w[i].reg != 0x28 || w[i].val != offs[i])
+      return FALSE;
+  }
+  for (; i < n && (w[i].port || w[i].reg != 0x28); i++){
+    if (w[i].reg < 0xA0 || w[i].reg >= 0xB0)
+      continue;
+    /* An MSB (0xA4-0xA6, 0xAC-0xAE), then the LSB latching it */
+    if ((w[i].reg & 7) < 4 || i + 1 >= n || w[i + 1].port != w[i].port ||
+        w[i + 1].reg != w[i].reg - 4)
+      return FALSE;
+    (*pairs)++;
+    i++;
+  }
+  for (; i < n; i++){
+    if (w[i].port || w[i].reg != 0x28 || !(w[i].val & 0xF0))
+      return FALSE;
+    (*keyOns)++;
+  }
+  return TRUE;
+}
+
+/**
+ * \brief Skips parts of a stream, and checks the writes rebuilding the chip
+ * state. The stream restarts first with channel 6 keyed on, and the
+ * skipped span only keys channel 1 on: the shadow must not key channel 6
+ * back on. A second span then only changes a few registers.
+ *
+ * \return TRUE if both restores are right.
+ ****************************************************************************/
+static uint8_t TestRestore(void)
+{
+  /* Key offs, channel 3 operator 2 frequency, a port 1 register, and the
+   * key on left from the first span */
+  static const EmuBusWrite expect[10] = {
+    {0x2b0, 0, 0x28, 0x00}, {0x2b0, 0, 0x28, 0x01}, {0x2b0, 0, 0x28, 0x02},
+    {0x2b0, 0, 0x28, 0x04}, {0x2b0, 0, 0x28, 0x05}, {0x2b0, 0, 0x28, 0x06},
+    {0x2b0, 0, 0xAD, 0x22}, {0x2b0, 0, 0xA9, 0x00}, {0x2b0, 1, 0x31, 0x07},
+    {0x2b0, 0, 0x28, 0xF0}
+  };
+  const EmuBusWrite *w;
+  uint16_t start, n, i;
+  uint16_t pairs, keyOns;
+  uint8_t ok;
+
+  Ym2612Init();
+  Ym2612SetBase(0, 0x2b0);
+  EmuBusInit(TEST_IO_NS, TEST_JITTER, TEST_BUSY_NS);
+  Ym2612SetIo(EmuBusIo());
+  Ym2612SetClock(TEST_CLK);
+
+  /* Channel 3 special mode frequencies, channel 6 keyed on */
+  Ym2612QueueWrite(0, 0, 0x27, 0x40);
+  Ym2612QueueWrite(0, 0, 0xAC, 0x12);
+  Ym2612QueueWrite(0, 0, 0xA8, 0x34);
+  Ym2612QueueWrite(0, 1, 0xA6, 0x22);
+  Ym2612QueueWrite(0, 1, 0xA2, 0x56);
+  Ym2612QueueWrite(0, 0, 0x28, 0xF5);
+  Ym2612Flush();
+  EmuBusGetLog(&start);
+
+  /* Stream restarts, then a span keying channel 1 on is skipped. All the
+   * registers are rebuilt, the 12 frequency pairs included */
+  Ym2612ResetShadow();
+  Ym2612Skip(TRUE);
+  Ym2612QueueWrite(0, 0, 0x28, 0xF0);
+  Ym2612Skip(FALSE);
+  Ym2612Flush();
+  w = EmuBusGetLog(&n);
+  ok = TestRestoreOrder(w + start, n - start, &pairs, &keyOns) &&
+    12 == pairs && 1 == keyOns && 0xF0 == w[n - 1].val;
+  for (i = start; i < n; i++){
+    if (!w[i].port && 0x28 == w[i].reg && 0xF5 == w[i].val)
+      ok = FALSE;
+  }
+  printf("restore, stale writes %4u  frequency pairs %2u  key ons %u\n",
+         (unsigned)(n - start), (unsigned)pairs, (unsigned)keyOns);
+  start = n;
+
+  /* Only the registers written while skipping are restored */
+  Ym2612Skip(TRUE);
+  Ym2612QueueWrite(0, 0, 0xAD, 0x22);
+  Ym2612QueueWrite(0, 1, 0x31, 0x07);
+  Ym2612Skip(FALSE);
+  Ym2612Flush();
+  w = EmuBusGetLog(&n);
+  printf("restore        writes %4u\n", (unsigned)(n - start));
+  if (n - start != 10)
+    ok = FALSE;
+  for (i = 0; ok && i < 10; i++){
+    if (w[start + i].base != expect[i].base ||
+        w[start + i].port != expect[i].port ||
+        w[start + i].reg != expect[i].reg || w[start + i].val != expect[i].val)
+      ok = FALSE;
+  }
+  if (EmuBusGetStats()->violations)
+    ok = FALSE;
+  if (!ok)
+    printf("FAIL: restore\n");
+  return ok;
+}
+
+/* Checks a run, returning its status read count or 0 on failure */
+static uint32_t TestCheck(const char *name, const EmuBusStats *st,
+                          uint32_t writes)
+{
+  printf("%-14s writes %6lu  status reads %6lu  violations %lu\n", name,
+         (unsigned long)st->writes, (unsigned long)st->reads,
+         (unsigned long)st->violations);
+  if (st->violations || st->writes != writes){
+    printf("FAIL: %s\n", name);
+    return 0;
+  }
+  return st->reads;
+}
+
+int main(void)
+{
+  uint32_t poll, budget, budgetTimed, gaps;
+
+  poll = TestCheck("poll", TestPlay(YM2612_PACE_POLL, FALSE, TEST_CLK),
+                   TEST_WRITES);
+  budget = TestCheck("budget", TestPlay(YM2612_PACE_BUDGET, FALSE, TEST_CLK),
+                     TEST_WRITES);
+  budgetTimed = TestCheck("budget, timed",
+                          TestPlay(YM2612_PACE_BUDGET, TRUE, TEST_CLK),
+                          TEST_WRITES);
+  /* A rip made for a faster chip must not shorten the card busy time */
+  gaps = TestCheck("gaps, 8 MHz", TestGaps(TEST_FAST_CLK), TEST_GAPS);
+  if (!poll || !budget || !budgetTimed || !gaps || !TestRestore())
+    return 1;
+  /* Untimed, budget pacing can only count its own I/O. It saves little,
+   * but must never read more than polling */
+  if (budget > poll){
+    printf("FAIL: budget pacing reads more than polling\n");
+    return 1;
+  }
+  if (budgetTimed >= poll){
+    printf("FAIL: budget pacing doesn't save status reads\n");
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
@@ -10,151 +10,243 @@
 #include <string.h>
 #include "vgm.h"
 #include "ym2612.h"
+#include "arena.h"
+#include "merge.h"
 
 typedef struct
 {
   VgmHead h;
   FILE *f;
   VgmStat s;
+  uint8_t ymChips; /* Number of YM2612 chips used by the stream */
+  Arena mem;       /* All the memory used by the opened file */
+  uint8_t *bank;   /* YM2612 PCM data bank, from type 0x00 data blocks */
+  uint32_t bankSize; /* Bank size, as found by the pre-scan */
+  uint32_t bankLen;  /* Bank bytes loaded so far */
+  uint32_t bankPos;  /* Next bank byte to send to the DAC */
+  uint32_t cursor;   /* Samples played from the start of the stream */
+  uint8_t skip;      /* Fast forwarding, writes only update the shadow */
+  uint32_t memCap;   /* Most memory an opened file may use */
 } VgmData;
 
 /* VGM module datam */
 static VgmData vd;
 
-void VgmTimerHandler(void)
+/* Closes the file and releases its memory, returning the error passed */
+static VGMErrorCode VgmAbort(VGMErrorCode err)
 {
-  /* Clear interrupt flag */
+  fclose(vd.f);
+  MergeInit(NULL);
+  ArenaRelease(&vd.mem);
+  vd.s = VGM_CLOSE;
+  return err;
 }
 
-/**
- * \brief Module initialization. Must be called once before any other
- * function.
- ****************************************************************************/
-void VgmInit(void)
+/* Moves the file pointer to the start of the VGM stream */
+static void VgmSeekStream(void)
 {
-  /* Initialize submodules */
-  Ym2612Init();
+  /* Offset is relative to 0x34, and 0 before 1.50 for a stream at 0x40 */
+  fseek(vd.f, (long int)0x34, SEEK_SET);
+  fseek(vd.f, vd.h.VgmStreamOffset ? (long int)vd.h.VgmStreamOffset : 0x0CL,
+        SEEK_CUR);
+}
+
+/* Returns the number of bytes following a command, or VGM_CMD_UNKNOWN */
+static uint8_t VgmCmdLen(uint8_t command)
+{
+  switch (command & 0xF0){
+  case 0x70:
+  case 0x80:
+    return 0;
+  }
+  switch (command){
+  case 0x52:
+  case 0x53:
+  case 0xA2:
+  case 0xA3:
+  case 0x61:
+    return 2;
+  case 0x50:
+    return 1;
+  case 0x62:
+  case 0x63:
+  case 0x66:
+    return 0;
+  case 0x67:
+    return 6;
+  case 0xE0:
+    return 4;
+  }
+  return VGM_CMD_UNKNOWN;
 }
 
 /**
- * \brief Opens a VGM file and parses its header, to get ready to play it.
+ * \brief Walks the whole VGM stream without sending anything, adding up
+ * the size of the YM2612 PCM data blocks.
  *
- * \param[in] fileName Name of the file to open.
+ * \param[out] bankSize Total size of the PCM data blocks.
  * \return
- * - VGM_OK File has been opened and parsed correctly.
- * - VGM_FILE_ERR File couldn't be opened and read correctly.
- * - VGM_HEAD_ERR VGM header checks failed.
+ * - VGM_OK Stream walked up to the end.
  * - VGM_STREAM_ERR Stream format is not correct.
- * - VGM_NOT_SUPPORTED VGM header looks correct but file is not supported.
  ****************************************************************************/
-VGMErrorCode VgmOpen(char *fileName)
+static VGMErrorCode VgmScan(uint32_t *bankSize)
 {
-  size_t readed;
   VgmDataBlock block;
-  YM2612Data data;
-  uint32_t pointer;
-  uint16_t wait;
   uint8_t command;
-  uint8_t i;
-  uint32_t pos;
-
-  block.data = NULL;
+  uint8_t len;
+  uint8_t chip2;
 
-  /* Set some default values */
-  memset(&vd.h, 0, VGM_MAX_HEADLEN);
-  vd.h.snFeedback = 0x0009;
-  vd.h.snNfsrLen = 16;
-  /* Open the file */
-  vd.s = VGM_CLOSE;
-  if ((vd.f = fopen(fileName, "r")) == NULL){
-    fprintf(stderr, "File %s open error.\r\n", fileName);
-    return VGM_FILE_ERR;
-  }
-
-  /* Read fields of 1.00 VGM header, checking for errors */
-  readed = fread(&vd.h, 1, VGM_MIN_HEADLEN, vd.f);
-  if (!readed){
-    fclose(vd.f);
-    fprintf(stderr, "VGM_FILE_ERR 1\r\n");
-    return VGM_FILE_ERR;
-  }
-  if (readed < VGM_MIN_HEADLEN){
-    fclose(vd.f);
-    fprintf(stderr, "VGM_HEAD_ERR 1\r\n");
-    return VGM_HEAD_ERR;
+  *bankSize = 0;
+  VgmSeekStream();
+  while (fread(&command, sizeof(uint8_t), 1, vd.f) && 0x66 != command){
+    if ((len = VgmCmdLen(command)) == VGM_CMD_UNKNOWN){
+      fprintf(stderr, "wtf? 0x%02x\n", command);
+      return VGM_STREAM_ERR;
+    }
+    /* Arguments are read rather than seeked over, as a seek throws away
+     * the stdio buffer. A data block header is read the same way */
+    if (len && fread(&block, 1, len, vd.f) != len)
+      return VGM_STREAM_ERR;
+    if (0x67 != command)
+      continue;
+    /* Only chip 0 blocks make the bank, as in VgmRun() */
+    chip2 = (block.size & VGM_BLOCK_CHIP2) != 0;
+    block.size &= VGM_BLOCK_SIZE_MASK;
+    if (block.size > vd.h.eofOffset)
+      return VGM_STREAM_ERR;
+    if (VGM_BLOCK_YM2612_PCM == block.type && !chip2)
+      *bankSize += block.size;
+    /* Only block payloads are long enough to be worth a seek */
+    fseek(vd.f, (long int)block.size, SEEK_CUR);
   }
+  if (*bankSize > vd.h.eofOffset)
+    return VGM_STREAM_ERR;
+  return VGM_OK;
+}
 
-  /* Check for file identification "VGM " string */
-  /* if (0x206D6756 != vd.h.ident){ */
-  if (vd.h.ident[0] != 0x56 || vd.h.ident[1] != 0x67 || vd.h.ident[2] != 0x6d || vd.h.ident[3] != 0x20){
-    fclose(vd.f);
-    printf("VGM_HEAD_ERR 2 |0x%08x|\r\n", (long int)vd.h.ident);
-    return VGM_HEAD_ERR;
-  }
+/* Sends a merged write to its YM2612 queue */
+static void VgmYmSink(const MergeEvent *e)
+{
+  Ym2612QueueWrite(e->chip, e->port, e->reg, e->val);
+}
 
-  /* Read extra fields if header version is 1.51 or greater */
-  if (1.51 <= vd.h.version){
-    readed = fread(&vd.h.rf5c68Clk, 1, VGM_MAX_HEADLEN - VGM_MIN_HEADLEN, vd.f);
-    if (!readed || ((VGM_MAX_HEADLEN - VGM_MIN_HEADLEN) != readed)){
-      fclose(vd.f);
-      fprintf(stderr, "VGM_HEAD_ERR 3\r\n");
-      return VGM_HEAD_ERR;
-    }
+/* Hands a write due at the cursor to the merger */
+static void VgmWrite(MergeSource source, uint8_t chip, uint8_t port,
+                     uint8_t reg, uint8_t val)
+{
+  /* Skipped YM2612 writes go straight to the shadow registers */
+  if (vd.skip){
+    if (MERGE_PSG != source)
+      Ym2612QueueWrite(chip, port, reg, val);
+    return;
   }
+  MergePush(source, chip, port, reg, val, vd.cursor);
+}
 
-  /* Check this is a Master System or Megadrive/Genesis VGM file */
-  if (!vd.h.ym2612Clk && !vd.h.sn76489Clk){
-    fclose(vd.f);
-    fprintf(stderr, "VGM_HEAD_ERR 4\r\n");
-    return VGM_HEAD_ERR;
-  }
+/* Sends the merged writes due before the cursor */
+static void VgmAdvance(void)
+{
+  if (vd.skip)
+    return;
+  MergeAdvance(vd.cursor);
+  Ym2612Flush();
+}
 
-  /* File OK, go to stop state */
-  vd.s = VGM_STOP;
+/* Sends every write still pending at the end of the stream */
+static void VgmFinish(void)
+{
+  if (vd.skip)
+    return;
+  MergeDrain();
+  Ym2612Flush();
+}
 
-  fprintf(stderr, "Version: 0x%08x\r\n", vd.h.version);
-  fprintf(stderr, "OPN2 clock: 0x%08x\r\n", vd.h.ym2612Clk);
-  fprintf(stderr, "OPN2 clock: %u\r\n", vd.h.ym2612Clk);
-  fprintf(stderr, "VGM rate: %d\r\n", vd.h.rate);
-  fprintf(stderr, "VGM Data offset: 0x%08x\r\n", vd.h.VgmStreamOffset);
-  /* return VGM_OK; */
+/**
+ * \brief Goes back to the start of the VGM stream.
+ ****************************************************************************/
+static void VgmRewind(void)
+{
+  VgmSeekStream();
+  /* Data blocks are loaded again as they are found */
+  vd.bankLen = vd.bankPos = 0;
+  vd.cursor = 0;
+  MergeReset(0);
+  /* Nothing written in a previous run counts for this one */
+  Ym2612ResetShadow();
+}
 
-  /* go to data offset value */
-  fseek(vd.f, (long int)0x34, SEEK_SET);
-  fseek(vd.f, (long int)vd.h.VgmStreamOffset, SEEK_CUR);
+/**
+ * \brief Runs the VGM stream until the cursor reaches the target sample.
+ * Writes are sent to the chips, unless the YM2612 module is skipping.
+ *
+ * \param[in] target Sample to stop at.
+ * \return
+ * - VGM_OK Target reached.
+ * - VGM_EOF Reached end of stream before the target.
+ * - VGM_STREAM_ERR Stream format is not correct.
+ * - VGM_ERROR Unsupported command found.
+ ****************************************************************************/
+static VGMErrorCode VgmRun(uint32_t target)
+{
+  size_t readed;
+  VgmDataBlock block;
+  YM2612Data data;
+  uint32_t pointer;
+  uint16_t wait;
+  uint8_t command;
+  uint8_t chip2;
 
-  while (1){
-    fread(&command, sizeof(uint8_t), 1, vd.f);
+  while (vd.cursor < target && fread(&command, sizeof(uint8_t), 1, vd.f)){
     switch (command){
     case 0x67:
       fread(&block, 1, 6, vd.f);
-      if (block.data != NULL){
-        free(block.data);
+      /* 0x8n only plays from chip 0, and 0xE0 offsets only count its
+       * blocks. Second chip blocks are skipped, so they don't shift them */
+      chip2 = (block.size & VGM_BLOCK_CHIP2) != 0;
+      block.size &= VGM_BLOCK_SIZE_MASK;
+      if (VGM_BLOCK_YM2612_PCM != block.type || chip2){
+        fseek(vd.f, (long int)block.size, SEEK_CUR);
+        break;
       }
-      if (block.size > UINT_MAX) {
+      /* Blocks are appended to the bank, pre-scan made room for them */
+      if (block.size > vd.bankSize - vd.bankLen){
         return VGM_STREAM_ERR;
       }
-      block.data = (uint8_t *)malloc((size_t)block.size);
-      if (block.data == NULL){
-        return VGM_ERROR;
-      }
-      block.current = block.data;
-      readed = fread(block.data, 1, block.size, vd.f);
-      fseek(vd.f, block.size, SEEK_CUR); /* fix dos? */
+      readed = fread(vd.bank + vd.bankLen, 1, (size_t)block.size, vd.f);
+      vd.bankLen += readed;
       /* fprintf(stderr, "Data block (%d/%d bytes)\n", readed, block.size); */
       break;
     case 0x52:
     case 0x53:
+    case 0xA2:
+    case 0xA3:
       fread(&data, 1, sizeof(YM2612Data), vd.f);
       /* fprintf(stderr, "Port %d, reg 0x%02x, value 0x%02x\n", (command==0x52)?0:1, data.reg, data.value); */
+      VgmWrite(MERGE_FM, (uint8_t)(command >> 7), (uint8_t)(command & 1),
+               (uint8_t)data.reg, data.value);
+      break;
+    case 0x50:
+      fread(&data.value, 1, sizeof(uint8_t), vd.f);
+      VgmWrite(MERGE_PSG, 0, 0, 0, data.value);
       break;
     case 0x61:
       fread(&wait, 1, sizeof(uint16_t), vd.f);
+      vd.cursor += wait;
+      VgmAdvance();
       /* fprintf(stderr, "Wait %d samples\n", wait); */
       break;
+    case 0x62:
+      vd.cursor += VGM_WAIT_NTSC;
+      VgmAdvance();
+      break;
+    case 0x63:
+      vd.cursor += VGM_WAIT_PAL;
+      VgmAdvance();
+      break;
     case 0x66:
       /* fprintf(stderr, "End of data\n", wait); */
-      return VGM_OK;
+      VgmFinish();
+      return VGM_EOF;
 
       break;
     case 0x70:
@@ -173,6 +265,8 @@ VGMErrorCode VgmOpen(char *fileName)
     case 0x7D:
     case 0x7E:
     case 0x7F:
+      vd.cursor += (command & 0x0f) + 1;
+      VgmAdvance();
       /* fprintf(stderr, "Wait %d samples\n", command & 0x0f + 1); */
       break;
     case 0x80:
@@ -191,16 +285,18 @@ VGMErrorCode VgmOpen(char *fileName)
     case 0x8D:
     case 0x8E:
     case 0x8F:
-      if ((block.data + block.size) > block.current){
-        Ym2612RegWrite((uint8_t)0, (uint8_t)0x2A, *block.current++);
+      if (vd.bankPos < vd.bankLen){
+        VgmWrite(MERGE_DAC, (uint8_t)0, (uint8_t)0, (uint8_t)0x2A, vd.bank[vd.bankPos++]);
       }
+      vd.cursor += command & 0x0f;
+      VgmAdvance();
       /* wait (command & 0x0f); */
       /* fprintf(stderr, "Send PCM Data. Wait %d samples.\n", (command & 0x0f)); */
       break;
     case 0xE0:
       fread(&pointer, 1, sizeof(uint32_t), vd.f);
-      if (pointer != 0)
-        fseek(vd.f, (long int)pointer, SEEK_CUR);
+      /* Seek in the PCM data bank, not in the file */
+      vd.bankPos = pointer;
 
       /* fprintf(stderr, "Go to data block.\n", wait); */
       break;
@@ -212,9 +308,175 @@ VGMErrorCode VgmOpen(char *fileName)
 
   }
 
+  if (vd.cursor < target){
+    VgmFinish();
+    return VGM_EOF;
+  }
+  return VGM_OK;
+}
+
+
+void VgmTimerHandler(void)
+{
+  /* Clear interrupt flag */
+}
+
+/**
+ * \brief Module initialization. Must be called once before any other
+ * function.
+ ****************************************************************************/
+void VgmInit(void)
+{
+  /* Initialize submodules */
+  Ym2612Init();
+  /* No SN76489 driver yet, PSG writes are only timed */
+  MergeSetSink(MERGE_FM, VgmYmSink);
+  MergeSetSink(MERGE_DAC, VgmYmSink);
+  vd.memCap = VGM_ARENA_MAX;
+}
+
+/**
+ * \brief Opens a VGM file and parses its header, to get ready to play it.
+ *
+ * \param[in] fileName Name of the file to open.
+ * \return
+ * - VGM_OK File has been opened and parsed correctly.
+ * - VGM_FILE_ERR File couldn't be opened and read correctly.
+ * - VGM_HEAD_ERR VGM header checks failed.
+ * - VGM_STREAM_ERR Stream format is not correct.
+ * - VGM_NOT_SUPPORTED VGM header looks correct but file is not supported.
+ * - VGM_MEM_ERR File needs more memory than the cap or available.
+ ****************************************************************************/
+VGMErrorCode VgmOpen(char *fileName)
+{
+  size_t readed;
+  uint32_t bufLen;
+  uint32_t memSize;
+  uint8_t *buf;
+  VGMErrorCode err;
+
+  /* Close previous file, if any */
+  if (VGM_CLOSE != vd.s && VGM_OK != VgmClose())
+    return VGM_BUSY;
+
+  /* Set some default values */
+  memset(&vd.h, 0, VGM_MAX_HEADLEN);
+  vd.h.snFeedback = 0x0009;
+  vd.h.snNfsrLen = 16;
+  /* Open the file */
+  vd.s = VGM_CLOSE;
+  if ((vd.f = fopen(fileName, "rb")) == NULL){
+    fprintf(stderr, "File %s open error.\r\n", fileName);
+    return VGM_FILE_ERR;
+  }
+
+  /* Read fields of 1.00 VGM header, checking for errors */
+  readed = fread(&vd.h, 1, VGM_MIN_HEADLEN, vd.f);
+  if (!readed){
+    fclose(vd.f);
+    fprintf(stderr, "VGM_FILE_ERR 1\r\n");
+    return VGM_FILE_ERR;
+  }
+  if (readed < VGM_MIN_HEADLEN){
+    fclose(vd.f);
+    fprintf(stderr, "VGM_HEAD_ERR 1\r\n");
+    return VGM_HEAD_ERR;
+  }
+
+  /* Check for file identification "VGM " string */
+  /* if (0x206D6756 != vd.h.ident){ */
+  if (vd.h.ident[0] != 0x56 || vd.h.ident[1] != 0x67 || vd.h.ident[2] != 0x6d || vd.h.ident[3] != 0x20){
+    fclose(vd.f);
+    printf("VGM_HEAD_ERR 2 |0x%08x|\r\n", (long int)vd.h.ident);
+    return VGM_HEAD_ERR;
+  }
+
+  /* Read extra fields if header version is 1.51 or greater */
+  if (1.51 <= vd.h.version){
+    readed = fread(&vd.h.rf5c68Clk, 1, VGM_MAX_HEADLEN - VGM_MIN_HEADLEN, vd.f);
+    if (!readed || ((VGM_MAX_HEADLEN - VGM_MIN_HEADLEN) != readed)){
+      fclose(vd.f);
+      fprintf(stderr, "VGM_HEAD_ERR 3\r\n");
+      return VGM_HEAD_ERR;
+    }
+  }
+
+  /* Check this is a Master System or Megadrive/Genesis VGM file */
+  if (!vd.h.ym2612Clk && !vd.h.sn76489Clk){
+    fclose(vd.f);
+    fprintf(stderr, "VGM_HEAD_ERR 4\r\n");
+    return VGM_HEAD_ERR;
+  }
+
+  /* Bit 30 of the clock flags a second YM2612 (commands 0xA2/0xA3) */
+  vd.ymChips = (vd.h.ym2612Clk & VGM_DUAL_CHIP) ? 2 : 1;
+  if (vd.ymChips > 1 && !Ym2612GetBase(1)){
+    fprintf(stderr, "No card for 2nd OPN2, its writes will be dropped\r\n");
+  }
+
+  Ym2612SetClock(vd.h.ym2612Clk & VGM_CLK_MASK);
+
+  /* File OK, go to stop state */
+  vd.s = VGM_STOP;
+
+  fprintf(stderr, "Version: 0x%08x\r\n", vd.h.version);
+  fprintf(stderr, "OPN2 clock: 0x%08x\r\n", vd.h.ym2612Clk & VGM_CLK_MASK);
+  fprintf(stderr, "OPN2 clock: %u\r\n", vd.h.ym2612Clk & VGM_CLK_MASK);
+  fprintf(stderr, "OPN2 chips: %d\r\n", vd.ymChips);
+  fprintf(stderr, "VGM rate: %d\r\n", vd.h.rate);
+  fprintf(stderr, "VGM Data offset: 0x%08x\r\n", vd.h.VgmStreamOffset);
+  /* return VGM_OK; */
+
+  /* Find out how much memory the file needs, and get it all at once */
+  vd.mem.base = NULL;
+  if ((err = VgmScan(&vd.bankSize)) != VGM_OK)
+    return VgmAbort(err);
+  /* No point in buffering more than the whole file */
+  bufLen = vd.h.eofOffset + 4;
+  if (bufLen > VGM_STREAM_BUFLEN)
+    bufLen = VGM_STREAM_BUFLEN;
+  memSize = ARENA_ROUND(bufLen) + ARENA_ROUND(vd.bankSize) +
+    ARENA_ROUND(MERGE_QUEUE_LEN * sizeof(MergeEvent));
+  if (memSize > vd.memCap){
+    fprintf(stderr, "File needs %lu bytes, cap is %lu\r\n",
+            (unsigned long)memSize, (unsigned long)vd.memCap);
+    return VgmAbort(VGM_MEM_ERR);
+  }
+  if (!ArenaCreate(&vd.mem, memSize)){
+    fprintf(stderr, "Can't allocate %lu bytes\r\n", (unsigned long)memSize);
+    return VgmAbort(VGM_MEM_ERR);
+  }
+  buf = (uint8_t *)ArenaAlloc(&vd.mem, bufLen);
+  vd.bank = (uint8_t *)ArenaAlloc(&vd.mem, vd.bankSize);
+  vd.bankLen = vd.bankPos = 0;
+  MergeInit((MergeEvent *)ArenaAlloc(&vd.mem,
+                                     MERGE_QUEUE_LEN * sizeof(MergeEvent)));
+
+  /* Reopen, so the stream can be buffered from the arena */
+  if ((vd.f = freopen(fileName, "rb", vd.f)) == NULL){
+    MergeInit(NULL);
+    ArenaRelease(&vd.mem);
+    vd.s = VGM_CLOSE;
+    return VGM_FILE_ERR;
+  }
+  setvbuf(vd.f, (char *)buf, _IOFBF, (size_t)bufLen);
+
+  VgmRewind();
   return VGM_OK;
 }
 
+/**
+ * \brief Sets the most memory an opened file may use, for its stream
+ * buffer, PCM data bank and write queue. Files needing more fail to open.
+ * Takes effect on the next VgmOpen().
+ *
+ * \param[in] bytes Memory cap in bytes. Defaults to VGM_ARENA_MAX.
+ ****************************************************************************/
+void VgmSetMemCap(uint32_t bytes)
+{
+  vd.memCap = bytes;
+}
+
 /************************************************************************//**
                                                                            * \brief Stars playing a previously opened VGM file.
                                                                            *
@@ -225,6 +487,8 @@ VGMErrorCode VgmOpen(char *fileName)
                                                                            ****************************************************************************/
 int VgmPlay(void)
 {
+  VGMErrorCode err;
+
   switch (vd.s)
     {
     case VGM_ERROR_STOP:
@@ -232,10 +496,17 @@ int VgmPlay(void)
     case VGM_PLAY: return VGM_BUSY;
     case VGM_STOP:
       /* Go to start of data, preload a data sector */
+      VgmRewind();
       /* Load samples if any */
     case VGM_PAUSE:
       vd.s = VGM_PLAY;
-      /* Enable timer. It will do all the work */
+      /* No timer yet, so the stream is played right away up to its end */
+      err = VgmRun(VGM_END_SAMPLE);
+      if (VGM_EOF != err){
+        vd.s = VGM_ERROR_STOP;
+        return VGM_ERROR;
+      }
+      vd.s = VGM_STOP;
       return VGM_OK;
     }
   return VGM_OK;
@@ -252,7 +523,49 @@ int VgmPlay(void)
                                                                            ****************************************************************************/
 int VgmFf(uint32_t timeMs)
 {
-  return VGM_OK;
+  uint32_t samples;
+  uint32_t target;
+  VGMErrorCode err;
+
+  switch (vd.s)
+    {
+    case VGM_ERROR_STOP:
+    case VGM_CLOSE: return VGM_ERROR;
+    case VGM_PLAY: return VGM_BUSY;
+    case VGM_STOP:
+      VgmRewind();
+      break;
+    case VGM_PAUSE:
+      break;
+    }
+
+  /* 44.1 samples per ms, avoiding overflow */
+  samples = timeMs / 10 * 441 + timeMs % 10 * 441 / 10;
+  target = (samples > VGM_END_SAMPLE - vd.cursor) ?
+    VGM_END_SAMPLE : vd.cursor + samples;
+
+  /* Walk the stream only keeping track of the chip registers, then
+   * write what's needed to get the chips to the landing point state */
+  vd.skip = TRUE;
+  Ym2612Skip(TRUE);
+  err = VgmRun(target);
+  Ym2612Skip(FALSE);
+  vd.skip = FALSE;
+  Ym2612Flush();
+  MergeReset(vd.cursor);
+
+  switch (err)
+    {
+    case VGM_OK:
+      vd.s = VGM_PAUSE;
+      return VGM_OK;
+    case VGM_EOF:
+      vd.s = VGM_STOP;
+      return VGM_EOF;
+    default:
+      vd.s = VGM_ERROR_STOP;
+      return VGM_ERROR;
+    }
 }
 
 /************************************************************************//**
@@ -303,7 +616,19 @@ int VgmStop(void)
                                                                            ****************************************************************************/
 int VgmClose(void)
 {
-  return VGM_OK;
+  switch (vd.s)
+    {
+    case VGM_CLOSE: return VGM_ERROR;
+    case VGM_PLAY: return VGM_BUSY;
+    default:
+      fclose(vd.f);
+      /* Everything the file used goes away at once */
+      MergeInit(NULL);
+      ArenaRelease(&vd.mem);
+      vd.bank = NULL;
+      vd.s = VGM_CLOSE;
+      return VGM_OK;
+    }
 }
 
 /************************************************************************//**
@@ -320,11 +645,11 @@ VgmHead *VgmGetHead(void)
 /************************************************************************//**
                                                                            * \brief Returns playback cursor
                                                                            *
-                                                                           * \return The playback cursor
+                                                                           * \return The playback cursor, in samples
                                                                            ****************************************************************************/
 uint32_t VgmGetCursor(void)
 {
-  return 0;
+  return vd.cursor;
 }
 
 /************************************************************************//**
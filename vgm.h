@@ -19,6 +19,35 @@
 
 #define VGM_MIN_HEADLEN     64
 
+/* ym2612Clk bit flagging a second chip, and mask to get the clock itself */
+#define VGM_DUAL_CHIP       0x40000000UL
+#define VGM_CLK_MASK        0x3FFFFFFFUL
+
+/* Data block type holding YM2612 PCM data, size bit flagging a block for
+ * the second chip, and mask to get the size itself */
+#define VGM_BLOCK_YM2612_PCM 0x00
+#define VGM_BLOCK_CHIP2      0x80000000UL
+#define VGM_BLOCK_SIZE_MASK  0x7FFFFFFFUL
+
+/* Samples waited by commands 0x62 and 0x63 */
+#define VGM_WAIT_NTSC       735
+#define VGM_WAIT_PAL        882
+
+/* Sample count meaning "until the end of the stream" */
+#define VGM_END_SAMPLE      0xFFFFFFFFUL
+
+/* Returned by the command length lookup for unsupported commands */
+#define VGM_CMD_UNKNOWN     0xFF
+
+/* File stream buffer length */
+#define VGM_STREAM_BUFLEN   4096
+
+/* Default cap of the memory used by an opened file, see VgmSetMemCap().
+ * Leaves room for the stack and the C library in a 64 KiB data segment */
+#ifndef VGM_ARENA_MAX
+#define VGM_ARENA_MAX       49152UL
+#endif
+
 /* Function completed without error */
 enum VGMErrorCode {
   VGM_OK=0,              /* Function failed */
@@ -29,7 +58,8 @@ enum VGMErrorCode {
   VGM_NOT_SUPPORTED=-5,  /* Reached end of VGM stream */
   VGM_EOF=-6,            /* Reached start of VGM stream */
   VGM_SOF=-7,            /* Cannot complete request because module is busy */
-  VGM_BUSY=-8
+  VGM_BUSY=-8,           /* File needs more memory than the cap or available */
+  VGM_MEM_ERR=-9
 };
 typedef enum VGMErrorCode VGMErrorCode;
 
@@ -44,8 +74,6 @@ typedef struct
   uint8_t fix;   /* 0x66 compatibility command to make older players stop parsing the stream */
   uint8_t type;  /* Data type */
   uint32_t size; /* Data size */
-  uint8_t *data; /* Data */
-  uint8_t *current;
 } /*__attribute__((packed))*/ VgmDataBlock;
 
 /* VGM header version 1.61 */
@@ -150,12 +178,24 @@ void VgmInit(void);
  * - VGM_HEAD_ERR VGM header checks failed.
  * - VGM_STREAM_ERR Stream format is not correct.
  * - VGM_NOT_SUPPORTED VGM header looks correct but file is not supported.
+ * - VGM_MEM_ERR File needs more memory than the cap or available.
  ****************************************************************************/
 VGMErrorCode VgmOpen(char *fileName);
 
 /************************************************************************/
 /**
- * \brief Stars playing a previously opened VGM file.
+ * \brief Sets the most memory an opened file may use, for its stream
+ * buffer, PCM data bank and write queue. Files needing more fail to open.
+ * Takes effect on the next VgmOpen().
+ *
+ * \param[in] bytes Memory cap in bytes. Defaults to VGM_ARENA_MAX.
+ ****************************************************************************/
+void VgmSetMemCap(uint32_t bytes);
+
+/************************************************************************/
+/**
+ * \brief Stars playing a previously opened VGM file. There is no playback
+ * timer yet, so the stream is played up to its end before returning.
  *
  * \return
  * - VGM_OK Playback has started
@@ -166,7 +206,9 @@ int VgmPlay(void);
 
 /************************************************************************/
 /**
- * \brief Advances the VGM file stream pointer
+ * \brief Advances the VGM file stream pointer. No writes are sent while
+ * skipping, only the final register state is written at the landing point
+ * (key offs first, then the changed registers, then key ons).
  *
  * \param[in] timeMs Time to advance in milliseconds.
  * \return
@@ -232,7 +274,7 @@ VgmHead *VgmGetHead(void);
 /**
  * \brief Returns playback cursor
  *
- * \return The playback cursor
+ * \return The playback cursor, in samples
  ****************************************************************************/
 uint32_t VgmGetCursor(void);
 
@@ -1,28 +1,470 @@
+#include <string.h>
+#ifdef YM2612_HOST
+#include "hostio.h"             /* Host build for tests */
+#else
+#include <dos.h>                /* peekb(), pokeb() */
+#endif
 #include "ym2612.h"
 
+/* Base port of the first card, as jumpered by default */
 #define OPN2 0x2b0
 
+/* Queue index wrap mask, YM2612_QUEUE_LEN must be a power of 2 */
+#define YM2612_QUEUE_MASK (YM2612_QUEUE_LEN - 1)
+
+/* Key on/off register, and its value to key off a channel */
+#define YM2612_KEY_REG 0x28
+#define YM2612_KEY_OFF(ch) ((uint8_t)(ch))
+
+/* Master clock cycles the busy flag stays set after a data write
+ * (32 internal cycles, each one being 6 master clock cycles) */
+#define YM2612_BUSY_CLKS 192UL
+
 /** \addtogroup ym2612_api
  *  \brief Module for controlling the YM2612 FM syntesizer. This module
  *  allows to use the YM2612 and write to its registers.
  *  \{ */
 
+typedef struct
+{
+  uint8_t port;
+  uint8_t reg;
+  uint8_t val;
+} Ym2612Write;
+
+typedef struct
+{
+  uint16_t base;                        /* Card base port, 0 if absent */
+  uint8_t head;                         /* Next free queue slot */
+  uint8_t tail;                         /* Next write to send */
+  uint8_t paced;                        /* lastWrite is known */
+  uint32_t lastWrite;                   /* busNs after last data write */
+  Ym2612Write q[YM2612_QUEUE_LEN];
+  uint8_t regs[2][256];                 /* Shadow register image */
+  uint8_t dirty[2][32];                 /* Registers written while skipping */
+  uint8_t keys[8];                      /* Last 0x28 value per channel code */
+  uint8_t stale;                        /* Chip may not match the shadow */
+} Ym2612Chip;
+
+/* One entry per card */
+static Ym2612Chip chips[YM2612_MAX_CHIPS];
+
+/* Port I/O backend in use */
+static const Ym2612Io *io;
+
+/* Write pacing mode */
+static Ym2612Pace pace;
+/* Lower bound of the time taken by a single bus I/O operation */
+static uint16_t ioNs;
+/* Post-write busy time, 0 if unknown */
+static uint32_t busyNs;
+/* Clock the stream was made for, and clock of the cards, 0 if unknown */
+static uint32_t streamClk;
+static uint32_t cardClk;
+/* Bus time known to have elapsed, modulo 2^32 ns */
+static uint32_t busNs;
+
+/* Writes only update the shadow registers while set */
+static uint8_t skip;
+
+static uint8_t Ym2612PortIn(uint16_t port)
+{
+  return peekb(0, port);
+}
+
+static void Ym2612PortOut(uint16_t port, uint8_t val)
+{
+  pokeb(0, val, port);
+}
+
+/* Default backend, real ISA ports */
+static const Ym2612Io ym2612PortIo = {Ym2612PortIn, Ym2612PortOut};
+
 void Ym2612Init(void)
 {
+  uint8_t chip;
+
+  for (chip = 0; chip < YM2612_MAX_CHIPS; chip++){
+    chips[chip].base = 0;
+    chips[chip].head = chips[chip].tail = 0;
+    chips[chip].paced = FALSE;
+  }
+  chips[0].base = OPN2;
+  skip = FALSE;
+  Ym2612ResetShadow();
+  io = &ym2612PortIo;
+  pace = YM2612_PACE_POLL;
+  ioNs = 0;
+  busyNs = 0;
+  busNs = 0;
+  streamClk = 0;
+  cardClk = YM2612_CARD_CLK;
+}
+
+/* Computes the busy time from the slowest clock known */
+static void Ym2612UpdateBusy(void)
+{
+  uint32_t kHz;
+
+  /* The cards set the real busy time, an unknown card clock leaves it
+   * unknown. A slower stream clock only makes the window longer */
+  kHz = cardClk;
+  if (streamClk && streamClk < kHz)
+    kHz = streamClk;
+  kHz /= 1000;
+  /* Round up, so the window is never shorter than the real one */
+  busyNs = kHz ? (YM2612_BUSY_CLKS * 1000000UL + kHz - 1) / kHz : 0;
+}
+
+/************************************************************************//**
+ * \brief Resets the shadow registers to the chip power-on state, all keys
+ * off. The chips may still hold older values, so the next skip rebuilds
+ * every register, not only the ones written while skipping.
+ ****************************************************************************/
+void Ym2612ResetShadow(void)
+{
+  uint8_t chip;
+  Ym2612Chip *c;
+
+  for (chip = 0; chip < YM2612_MAX_CHIPS; chip++){
+    c = &chips[chip];
+    memset(c->regs, 0, sizeof(c->regs));
+    /* Both outputs are enabled on reset */
+    c->regs[0][0xB4] = c->regs[0][0xB5] = c->regs[0][0xB6] = 0xC0;
+    c->regs[1][0xB4] = c->regs[1][0xB5] = c->regs[1][0xB6] = 0xC0;
+    memset(c->keys, 0, sizeof(c->keys));
+    c->stale = TRUE;
+  }
+}
+
+/************************************************************************//**
+ * \brief Sets the port I/O backend used to reach the chips.
+ *
+ * \param[in] backend Backend to use, or NULL for the real ISA ports.
+ ****************************************************************************/
+void Ym2612SetIo(const Ym2612Io *backend)
+{
+  uint8_t chip;
+
+  io = backend ? backend : &ym2612PortIo;
+  /* Chip timings seen through the previous backend are meaningless now */
+  for (chip = 0; chip < YM2612_MAX_CHIPS; chip++)
+    chips[chip].paced = FALSE;
+}
+
+/************************************************************************//**
+ * \brief Sets the YM2612 master clock the stream was made for. The busy
+ * time that follows each write comes from the slower of this clock and
+ * the card clock.
+ *
+ * \param[in] clk Master clock in Hz, 0 if unknown.
+ ****************************************************************************/
+void Ym2612SetClock(uint32_t clk)
+{
+  streamClk = clk;
+  Ym2612UpdateBusy();
+}
+
+/************************************************************************//**
+ * \brief Sets the master clock of the cards, the one that really sets the
+ * busy time that follows each write. Defaults to YM2612_CARD_CLK.
+ *
+ * \param[in] clk Card master clock in Hz, 0 if unknown (disables budget
+ *                pacing, as the busy time is then unknown).
+ ****************************************************************************/
+void Ym2612SetCardClock(uint32_t clk)
+{
+  cardClk = clk;
+  Ym2612UpdateBusy();
+}
+
+/************************************************************************//**
+ * \brief Sets how writes are paced.
+ *
+ * \param[in] mode  YM2612_PACE_POLL reads the status port before every
+ *                  write. YM2612_PACE_BUDGET skips the read when the busy
+ *                  time is known to have elapsed.
+ * \param[in] minNs Minimum time taken by one bus I/O operation, in ns.
+ *                  Must be a lower bound, or the busy window may be broken.
+ ****************************************************************************/
+void Ym2612SetPacing(Ym2612Pace mode, uint16_t minNs)
+{
+  pace = mode;
+  ioNs = minNs;
 }
 
+/************************************************************************//**
+ * \brief Accounts time known to have elapsed outside this module (e.g.
+ * a timed wait), so later writes can skip status reads.
+ *
+ * \param[in] ns Elapsed time in ns.
+ ****************************************************************************/
+void Ym2612Elapse(uint32_t ns)
+{
+  busNs += ns;
+}
 
 /************************************************************************//**
- * \brief Writes a value to the specified port and register of the YM2612.
+ * \brief Sets the base port of the card holding the specified chip.
  *
+ * \param[in] chip Chip number, 0 to YM2612_MAX_CHIPS - 1.
+ * \param[in] base Card base port. 0 disables the chip.
+ ****************************************************************************/
+void Ym2612SetBase(uint8_t chip, uint16_t base)
+{
+  if (chip < YM2612_MAX_CHIPS)
+    chips[chip].base = base;
+}
+
+/************************************************************************//**
+ * \brief Returns the base port of the card holding the specified chip.
+ *
+ * \param[in] chip Chip number.
+ * \return Card base port, or 0 if the chip is not present.
+ ****************************************************************************/
+uint16_t Ym2612GetBase(uint8_t chip)
+{
+  return (chip < YM2612_MAX_CHIPS) ? chips[chip].base : 0;
+}
+
+/* Sends a register write to the chip, without checking the busy flag */
+static void Ym2612Out(Ym2612Chip *c, uint8_t port, uint8_t reg, uint8_t val)
+{
+  uint16_t hwaddr = c->base + 2 * (port > 0);
+  io->out(hwaddr, reg);
+  io->out(hwaddr + 1, val);
+  /* Busy time starts once the data write has completed */
+  busNs += 2 * ioNs;
+  c->lastWrite = busNs;
+  c->paced = TRUE;
+}
+
+/* Checks if the busy time is known to have elapsed since the last write */
+static uint8_t Ym2612Proven(Ym2612Chip *c)
+{
+  return YM2612_PACE_BUDGET == pace && c->paced && busyNs &&
+    (uint32_t)(busNs - c->lastWrite) >= busyNs;
+}
+
+/* Reads the status port to check if the chip can take a write */
+static uint8_t Ym2612Poll(Ym2612Chip *c)
+{
+  uint8_t status;
+
+  status = io->in(c->base);
+  busNs += ioNs;
+  return !(status & 0x80);
+}
+
+/* Checks if the chip can take a write. Reads the status port only if the
+ * busy time cannot be proven to have elapsed since the last write */
+static uint8_t Ym2612Ready(Ym2612Chip *c)
+{
+  return Ym2612Proven(c) || Ym2612Poll(c);
+}
+
+/* Sends the oldest queued write of the chip */
+static void Ym2612Pop(Ym2612Chip *c)
+{
+  Ym2612Write *w = &c->q[c->tail];
+
+  Ym2612Out(c, w->port, w->reg, w->val);
+  c->tail = (c->tail + 1) & YM2612_QUEUE_MASK;
+}
+
+/* Keeps track of a write in the shadow registers */
+static void Ym2612Shadow(Ym2612Chip *c, uint8_t port, uint8_t reg, uint8_t val)
+{
+  /* Key on/off is a single register for all channels, keep one per channel */
+  if (YM2612_KEY_REG == reg && !port)
+    c->keys[val & 7] = val;
+  else
+    c->regs[port][reg] = val;
+  if (skip)
+    c->dirty[port][reg >> 3] |= 1 << (reg & 7);
+}
+
+/* Adds a write to the chip queue, servicing queues until there's room */
+static void Ym2612Push(Ym2612Chip *c, uint8_t port, uint8_t reg, uint8_t val)
+{
+  Ym2612Write *w;
+  uint8_t next;
+
+  next = (c->head + 1) & YM2612_QUEUE_MASK;
+  while (next == c->tail)
+    Ym2612Service();
+  w = &c->q[c->head];
+  w->port = port;
+  w->reg = reg;
+  w->val = val;
+  c->head = next;
+}
+
+/* Queues a shadow register if it was written while skipping */
+static void Ym2612PushDirty(Ym2612Chip *c, uint8_t port, uint8_t reg)
+{
+  if (c->dirty[port][reg >> 3] & (1 << (reg & 7)))
+    Ym2612Push(c, port, reg, c->regs[port][reg]);
+}
+
+/* Queues the writes taking the chip to its shadow register state */
+static void Ym2612Restore(Ym2612Chip *c)
+{
+  uint8_t port;
+  uint16_t reg;
+  uint8_t ch;
+
+  /* Key off all channels first */
+  for (ch = 0; ch < 7; ch++){
+    if (3 != ch)
+      Ym2612Push(c, 0, YM2612_KEY_REG, YM2612_KEY_OFF(ch));
+  }
+
+  for (port = 0; port < 2; port++){
+    for (reg = 0x21; reg < 0xB8; reg++){
+      /* Port 1 has no global registers */
+      if (YM2612_KEY_REG == reg || (port && reg < 0x30))
+        continue;
+      if (reg >= 0xA0 && reg < 0xB0){
+        /* Frequency MSBs are latched until the LSB write, always write
+         * both, MSB first */
+        if ((reg & 0x07) >= 3)
+          continue;
+        if ((c->dirty[port][reg >> 3] | c->dirty[port][(reg + 4) >> 3]) &
+            ((1 << (reg & 7)) | (1 << ((reg + 4) & 7)))){
+          Ym2612Push(c, port, (uint8_t)(reg + 4), c->regs[port][reg + 4]);
+          Ym2612Push(c, port, (uint8_t)reg, c->regs[port][reg]);
+        }
+        continue;
+      }
+      Ym2612PushDirty(c, port, (uint8_t)reg);
+    }
+  }
+
+  /* Key on whatever was on at the landing point */
+  for (ch = 0; ch < 7; ch++){
+    if (3 != ch && (c->keys[ch] & 0xF0))
+      Ym2612Push(c, 0, YM2612_KEY_REG, c->keys[ch]);
+  }
+}
+
+/************************************************************************//**
+ * \brief Enters or leaves skip mode. While skipping, writes only update
+ * the shadow registers. When leaving, the writes needed to rebuild the
+ * state of each chip are queued: key offs first, then the registers
+ * written while skipping (all of them after Ym2612ResetShadow()), then key
+ * ons.
+ *
+ * \param[in] on TRUE to enter skip mode, FALSE to leave it.
+ ****************************************************************************/
+void Ym2612Skip(uint8_t on)
+{
+  uint8_t chip;
+  Ym2612Chip *c;
+
+  if (on == skip)
+    return;
+  if (on){
+    Ym2612Flush();
+    for (chip = 0; chip < YM2612_MAX_CHIPS; chip++){
+      c = &chips[chip];
+      /* A stale chip gets all its registers rebuilt */
+      memset(c->dirty, c->stale ? 0xFF : 0, sizeof(c->dirty));
+    }
+    skip = TRUE;
+    return;
+  }
+  skip = FALSE;
+  for (chip = 0; chip < YM2612_MAX_CHIPS; chip++){
+    c = &chips[chip];
+    if (c->base){
+      Ym2612Restore(c);
+      c->stale = FALSE;
+    }
+  }
+}
+
+/************************************************************************//**
+ * \brief Writes a value to the specified port and register of the YM2612,
+ * waiting for the chip to be ready. Writes already queued to the chip are
+ * sent first, so the direct write never overtakes them.
+ *
+ * \param[in] chip Chip number to write to.
  * \param[in] port Port number to write to. Can be 0 or 1.
  * \param[in] reg  YM2612 register to write to.
  * \param[in] val  Value to write to the YM2612.
  ****************************************************************************/
-void Ym2612RegWrite(uint8_t port, uint8_t reg, uint8_t val)
+void Ym2612RegWrite(uint8_t chip, uint8_t port, uint8_t reg, uint8_t val)
 {
-  unsigned char hwaddr = OPN2 + 2 * (port > 0);
-  do {} while(peekb(0, OPN2) & 0x80);
-  pokeb(0, reg, hwaddr);
-  pokeb(0, val, hwaddr + 1);
+  Ym2612Chip *c;
+
+  if (chip >= YM2612_MAX_CHIPS || !chips[chip].base)
+    return;
+  c = &chips[chip];
+  Ym2612Shadow(c, port, reg, val);
+  if (skip)
+    return;
+  /* Other chips are serviced too while this one drains */
+  while (c->head != c->tail)
+    Ym2612Service();
+  do {} while(!Ym2612Ready(c));
+  Ym2612Out(c, port, reg, val);
+}
+
+/************************************************************************//**
+ * \brief Sends at most one queued write to every chip that is not busy.
+ * Chips are visited round-robin, so a busy chip never holds back writes
+ * to the others.
+ *
+ * \return TRUE if there are writes left in any queue, FALSE otherwise.
+ ****************************************************************************/
+uint8_t Ym2612Service(void)
+{
+  uint8_t chip;
+  uint8_t pending = FALSE;
+  Ym2612Chip *c;
+
+  /* Same visits as polling, a chip proven ready just skips its read */
+  for (chip = 0; chip < YM2612_MAX_CHIPS; chip++){
+    c = &chips[chip];
+    if (c->head == c->tail)
+      continue;
+    if (Ym2612Ready(c))
+      Ym2612Pop(c);
+    if (c->head != c->tail)
+      pending = TRUE;
+  }
+  return pending;
 }
+
+/************************************************************************//**
+ * \brief Queues a write to the specified chip. If the chip queue is full,
+ * queues are serviced until there is room for the new write.
+ *
+ * \param[in] chip Chip number to write to.
+ * \param[in] port Port number to write to. Can be 0 or 1.
+ * \param[in] reg  YM2612 register to write to.
+ * \param[in] val  Value to write to the YM2612.
+ ****************************************************************************/
+void Ym2612QueueWrite(uint8_t chip, uint8_t port, uint8_t reg, uint8_t val)
+{
+  Ym2612Chip *c;
+
+  /* Writes to missing chips are dropped */
+  if (chip >= YM2612_MAX_CHIPS || !chips[chip].base)
+    return;
+  c = &chips[chip];
+  Ym2612Shadow(c, port, reg, val);
+  if (!skip)
+    Ym2612Push(c, port, reg, val);
+}
+
+/************************************************************************//**
+ * \brief Sends all queued writes, interleaving chips round-robin.
+ ****************************************************************************/
+void Ym2612Flush(void)
+{
+  while (Ym2612Service());
+}
+
+/** \} */
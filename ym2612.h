@@ -40,11 +40,34 @@
 
 #include "types.h"
 
+/* Maximum number of YM2612 chips (one per card) */
+#define YM2612_MAX_CHIPS 4
+
+/* Per-chip write queue length. Must be a power of 2 not above 256 */
+#define YM2612_QUEUE_LEN 64
+
+/* Default card master clock, the NTSC Megadrive one */
+#define YM2612_CARD_CLK 7670453UL
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+/** Port I/O backend. Lets the module run against an emulated bus */
+typedef struct
+{
+  uint8_t (*in)(uint16_t port);            /* Reads a port */
+  void (*out)(uint16_t port, uint8_t val); /* Writes a port */
+} Ym2612Io;
+
+/** Write pacing modes */
+typedef enum
+  {
+    YM2612_PACE_POLL,   /* < Read the status port before each write */
+    YM2612_PACE_BUDGET  /* < Read it only if busy time may not have elapsed */
+  } Ym2612Pace;
+
 /************************************************************************//**
  * \brief Initializes the module, including hardware ports and YM2612 chip
  * itself. Must be called before using any other function in this module.
@@ -52,13 +75,135 @@ extern "C"
 void Ym2612Init(void);
 
 /************************************************************************//**
- * \brief Writes a value to the specified port and register of the YM2612.
+ * \brief Sets the port I/O backend used to reach the chips.
  *
+ * \param[in] backend Backend to use, or NULL for the real ISA ports.
+ ****************************************************************************/
+void Ym2612SetIo(const Ym2612Io *backend);
+
+/************************************************************************//**
+ * \brief Sets the YM2612 master clock the stream was made for. The busy
+ * time that follows each write comes from the slower of this clock and
+ * the card clock, so a stream made for a faster chip never shortens it.
+ *
+ * \param[in] clk Master clock in Hz, 0 if unknown.
+ ****************************************************************************/
+void Ym2612SetClock(uint32_t clk);
+
+/************************************************************************//**
+ * \brief Sets the master clock of the cards, the one that really sets the
+ * busy time that follows each write. Defaults to YM2612_CARD_CLK, cards
+ * with a slower crystal must set theirs for budget pacing to be safe.
+ *
+ * \param[in] clk Card master clock in Hz, 0 if unknown (disables budget
+ *                pacing, as the busy time is then unknown).
+ ****************************************************************************/
+void Ym2612SetCardClock(uint32_t clk);
+
+/************************************************************************//**
+ * \brief Sets how writes are paced. Defaults to YM2612_PACE_POLL.
+ *
+ * In YM2612_PACE_BUDGET mode, every bus I/O operation is accounted as
+ * taking minNs, and the status port is read only when that accounting
+ * can't prove the busy time of the previous write to the chip is over
+ * (not enough I/O since then, unknown clock or unknown last write).
+ * Chips are visited as in polling mode, a chip proven ready just skips its
+ * status read.
+ *
+ * Nearly all the saving comes from time credited with Ym2612Elapse(). VGM
+ * playback is not timed yet and doesn't call it, so for now budget mode
+ * reads the status port about as often as polling does, with one or two
+ * chips alike.
+ *
+ * \param[in] mode  Pacing mode.
+ * \param[in] minNs Minimum time taken by one bus I/O operation, in ns.
+ *                  Must be a lower bound, or the busy window may be broken.
+ ****************************************************************************/
+void Ym2612SetPacing(Ym2612Pace mode, uint16_t minNs);
+
+/************************************************************************//**
+ * \brief Accounts time known to have elapsed outside this module (e.g.
+ * a timed wait), so later writes can skip status reads. Only call it for
+ * time that has really passed: crediting time that didn't pass breaks the
+ * busy window.
+ *
+ * \param[in] ns Elapsed time in ns.
+ ****************************************************************************/
+void Ym2612Elapse(uint32_t ns);
+
+/************************************************************************//**
+ * \brief Sets the base port of the card holding the specified chip. Chip 0
+ * defaults to 0x2b0, the others are disabled until a base is set.
+ *
+ * \param[in] chip Chip number, 0 to YM2612_MAX_CHIPS - 1.
+ * \param[in] base Card base port. 0 disables the chip.
+ ****************************************************************************/
+void Ym2612SetBase(uint8_t chip, uint16_t base);
+
+/************************************************************************//**
+ * \brief Returns the base port of the card holding the specified chip.
+ *
+ * \param[in] chip Chip number.
+ * \return Card base port, or 0 if the chip is not present.
+ ****************************************************************************/
+uint16_t Ym2612GetBase(uint8_t chip);
+
+/************************************************************************//**
+ * \brief Resets the shadow registers to the chip power-on state, all keys
+ * off. The chips may still hold older values, so the next skip rebuilds
+ * every register, not only the ones written while skipping. Call it when
+ * the stream restarts from its beginning.
+ ****************************************************************************/
+void Ym2612ResetShadow(void);
+
+/************************************************************************//**
+ * \brief Enters or leaves skip mode. While skipping, writes only update
+ * the shadow registers. When leaving, the writes needed to rebuild the
+ * state of each chip are queued: key offs first, then the registers
+ * written while skipping (all of them after Ym2612ResetShadow()), then key
+ * ons.
+ *
+ * \param[in] on TRUE to enter skip mode, FALSE to leave it.
+ ****************************************************************************/
+void Ym2612Skip(uint8_t on);
+
+/************************************************************************//**
+ * \brief Writes a value to the specified port and register of the YM2612,
+ * waiting for the chip to be ready. Writes already queued to the chip are
+ * sent first, so the direct write never overtakes them.
+ *
+ * \param[in] chip Chip number to write to.
  * \param[in] port Port number to write to. Can be 0 or 1.
  * \param[in] reg  YM2612 register to write to.
  * \param[in] val  Value to write to the YM2612.
  ****************************************************************************/
-void Ym2612RegWrite(uint8_t port, uint8_t reg, uint8_t val);
+void Ym2612RegWrite(uint8_t chip, uint8_t port, uint8_t reg, uint8_t val);
+
+/************************************************************************//**
+ * \brief Queues a write to the specified chip. Writes to chips without a
+ * base port are dropped. If the chip queue is full, queues are serviced
+ * until there is room for the new write.
+ *
+ * \param[in] chip Chip number to write to.
+ * \param[in] port Port number to write to. Can be 0 or 1.
+ * \param[in] reg  YM2612 register to write to.
+ * \param[in] val  Value to write to the YM2612.
+ ****************************************************************************/
+void Ym2612QueueWrite(uint8_t chip, uint8_t port, uint8_t reg, uint8_t val);
+
+/************************************************************************//**
+ * \brief Sends at most one queued write to every chip that is not busy.
+ * Chips are visited round-robin, so a busy chip never holds back writes
+ * to the others.
+ *
+ * \return TRUE if there are writes left in any queue, FALSE otherwise.
+ ****************************************************************************/
+uint8_t Ym2612Service(void);
+
+/************************************************************************//**
+ * \brief Sends all queued writes, interleaving chips round-robin.
+ ****************************************************************************/
+void Ym2612Flush(void);
 
 #ifdef __cplusplus
 }